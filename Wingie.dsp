@@ -12,7 +12,7 @@ declare editDate    "2021-03-13";
 
 import("stdfaust.lib"); 
 
-nHarmonics = 9;
+nHarmonics = 9; // NHARMONICS in Wingie.cpp, the resonators are run by modalbank.h
 decay = hslider("decay", 5, 0.1, 10, 0.01) : si.smoo;
 input_gain = hslider("input_gain", 0.25, 0, 3, 0.01) : ba.lin2LogGain : si.smoo;
 input_gain_factor = hslider("input_gain_factor", 1,0,2,0.01) : ba.lin2LogGain;
@@ -585,22 +585,14 @@ class MapUI : public UI, public PathBuilder
         // set/get
         void setParamValue(const std::string& path, FAUSTFLOAT value)
         {
-            if (fPathZoneMap.find(path) != fPathZoneMap.end()) {
-                *fPathZoneMap[path] = value;
-            } else if (fLabelZoneMap.find(path) != fLabelZoneMap.end()) {
-                *fLabelZoneMap[path] = value;
-            }
+            FAUSTFLOAT* zone = getParamZone(path);
+            if (zone) *zone = value;
         }
         
         FAUSTFLOAT getParamValue(const std::string& path)
         {
-            if (fPathZoneMap.find(path) != fPathZoneMap.end()) {
-                return *fPathZoneMap[path];
-            } else if (fLabelZoneMap.find(path) != fLabelZoneMap.end()) {
-                return *fLabelZoneMap[path];
-            } else {
-                return FAUSTFLOAT(0);
-            }
+            FAUSTFLOAT* zone = getParamZone(path);
+            return (zone) ? *zone : FAUSTFLOAT(0);
         }
     
         // map access 
@@ -627,14 +619,13 @@ class MapUI : public UI, public PathBuilder
             return fNullStr;
         }
     
+        // One lookup per map, the full path first
         FAUSTFLOAT* getParamZone(const std::string& str)
         {
-            if (fPathZoneMap.find(str) != fPathZoneMap.end()) {
-                return fPathZoneMap[str];
-            }
-            if (fLabelZoneMap.find(str) != fLabelZoneMap.end()) {
-                return fLabelZoneMap[str];
-            }
+            auto path = fPathZoneMap.find(str);
+            if (path != fPathZoneMap.end()) return path->second;
+            auto label = fLabelZoneMap.find(str);
+            if (label != fLabelZoneMap.end()) return label->second;
             return nullptr;
         }
     
@@ -688,10 +679,35 @@ class MapUI : public UI, public PathBuilder
 #define __esp32audio__
 
 #include <utility>
+#include <atomic>
 
+#ifdef ESP_PLATFORM
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "driver/i2s.h"
+#include "esp_timer.h"
+#endif
+#include "sampleconvert.h"
+#include "audiostats.h"
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ With I2S_EVENT_QUEUE, the audio task sleeps on the event queue of the I2S
+ driver and wakes up when the DMA completes a buffer, the reads that follow
+ never wait. The control callbacks then run after the block is written, while
+ the DMA plays it, rather than between the read and the DSP. DMA errors
+ reported by the driver count as overruns. After an xrun or a DMA error, the
+ events still queued are stale and dropped, so that the next wait is for the
+ next buffer. Set to 0 to block in i2s_read as before.
+*/
+#ifndef I2S_EVENT_QUEUE
+#define I2S_EVENT_QUEUE 1
+#endif
 
 /************************** BEGIN audio.h **************************/
 /************************************************************************
@@ -777,101 +793,770 @@ class audio {
     
         // Returns the average proportion of available CPU being spent inside the audio callbacks (between 0 and 1.0).
         virtual float getCPULoad() { return 0.f; }
+    
+        // Returns the number of blocks lost so far, because the audio callbacks were too late (overruns and underruns).
+        virtual int getXRuns() { return 0; }
 };
 					
 #endif
 /**************************  END  audio.h **************************/
 
-#define MULT_S32 2147483647
-#define DIV_S32 4.6566129e-10
-#define clip(sample) std::max(-MULT_S32, std::min(MULT_S32, ((int32_t)(sample * MULT_S32))));
+/**
+ * Memory arena of the audio engine.
+ *
+ * One block reserved at once, in internal RAM on the ESP32, then handed out in
+ * ARENA_ALIGN aligned pieces: the DSP state (mydsp::create) and the buffers
+ * of esp32audio. Pieces are not freed one by one, the arena is rewound to a
+ * previous size and the block reused, so that init after init does not go
+ * through the allocator. When the block is full, pieces come from the heap
+ * (still aligned) and are freed by destroy.
+ */
+
+#ifndef ARENA_ALIGN
+#define ARENA_ALIGN 32      // the AVX vectors of modalbank.h on the host
+#endif
+
+// Aligned heap allocation, in internal RAM on the ESP32: the audio task works in it every block
+static inline void* arena_aligned_alloc(size_t size)
+{
+    size_t total = size + ARENA_ALIGN + sizeof(void*);
+#ifdef ESP_PLATFORM
+    char* block = (char*)heap_caps_malloc(total, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#else
+    char* block = (char*)malloc(total);
+#endif
+    if (!block) return nullptr;
+    // The block pointer is kept just before the aligned address
+    char* ptr = (char*)((uintptr_t(block) + sizeof(void*) + ARENA_ALIGN - 1) & ~uintptr_t(ARENA_ALIGN - 1));
+    ((void**)ptr)[-1] = block;
+    return ptr;
+}
+
+static inline void arena_aligned_free(void* ptr)
+{
+    if (ptr) free(((void**)ptr)[-1]);
+}
+
+class dsparena : public dsp_memory_manager {
+    
+    private:
+    
+        char* fBlock;
+        size_t fSize;
+        size_t fUsed;
+    
+    public:
+    
+        dsparena():fBlock(nullptr), fSize(0), fUsed(0) {}
+        virtual ~dsparena() { arena_aligned_free(fBlock); }
+    
+        // Size of a piece in the arena
+        static size_t align(size_t size) { return (size + ARENA_ALIGN - 1) & ~size_t(ARENA_ALIGN - 1); }
+    
+        // Empty the arena with room for 'size' bytes, keeping the block if it is large enough
+        bool reserve(size_t size)
+        {
+            fUsed = 0;
+            if (size <= fSize) return true;
+            arena_aligned_free(fBlock);
+            fBlock = (char*)arena_aligned_alloc(size);
+            fSize = (fBlock) ? size : 0;
+            return (fBlock != nullptr);
+        }
+    
+        virtual void* allocate(size_t size)
+        {
+            size = align(size);
+            if (fUsed + size > fSize) return arena_aligned_alloc(size);
+            void* ptr = fBlock + fUsed;
+            fUsed += size;
+            return ptr;
+        }
+    
+        virtual void destroy(void* ptr)
+        {
+            if (!contains(ptr)) arena_aligned_free(ptr);
+        }
+    
+        bool contains(void* ptr) { return (ptr >= fBlock && ptr < fBlock + fSize); }
+    
+        size_t getUsed() { return fUsed; }
+        // Give back the pieces allocated since getUsed returned 'used'
+        void rewind(size_t used) { fUsed = std::min<size_t>(used, fUsed); }
+    
+};
 
 #define AUDIO_MAX_CHAN 2
 
+// Arena bytes of the channel buffers and of the int32 frames of a driver
+static inline size_t audio_arena_size(int inputs, int outputs, int bsize)
+{
+    return dsparena::align(sizeof(FAUSTFLOAT*)*inputs) + dsparena::align(sizeof(FAUSTFLOAT*)*outputs)
+        + (inputs + outputs)*dsparena::align(sizeof(FAUSTFLOAT)*bsize)
+        + dsparena::align(sizeof(int32_t)*AUDIO_MAX_CHAN*bsize);
+}
+
+/**
+ * Parameter changes from the control loop to the audio task.
+ *
+ * A single producer, single consumer ring of events (a zone, its new value
+ * and the frame it is due at), so that the control loop never writes the
+ * zones while the DSP reads them on the other core. The producer fills the
+ * slots and publishes them by moving fWrite (release), the consumer applies
+ * them as it computes and gives the slots back by moving fRead (release).
+ * Neither side ever waits for the other.
+ *
+ * Between begin and end, the events are held back and published at once, so
+ * that changes which go together (a note and its mode_changed trigger) reach
+ * the DSP in the same block.
+ *
+ * A change of a zone whose last event is still queued, held back or
+ * published, replaces the value of that event rather than taking a slot,
+ * when both would be applied at the same point: at the same date, or both
+ * already due. A pot turned faster than the audio task drains the queue then
+ * takes one slot. The consumer takes the value of an event with an atomic
+ * exchange that marks it applied, the producer replaces it with a compare
+ * and exchange that fails once it is, and then queues a new event.
+ *
+ * Dates count the frames computed since the start, modulo 2^32 (27 hours at
+ * 44.1 kHz). The consumer cuts its blocks at the dates of the events (see
+ * apply), so that each one lands on its frame, or on the first frame of the
+ * next block if it is already past. Events stay in order, one waiting for
+ * the dates of those queued before it: an undated change pushed after a
+ * dated one not due yet (a key press, dated one block ahead) is applied with
+ * it, up to a block later than it would alone. The producer gets dates from the time
+ * of the platform clock with getDate, against the reference the consumer
+ * gives with setClock (a sequence lock, retried in the rare case it was
+ * being updated).
+ */
+
+#ifndef PARAM_QUEUE_SIZE
+#define PARAM_QUEUE_SIZE 256    // events, a power of two
+#endif
+
+class paramqueue {
+
+    private:
+
+        struct event {
+            FAUSTFLOAT* fZone;
+            std::atomic<uint32_t> fValue;   // bits of the value, kApplied once the consumer took it
+            uint32_t fDate;
+        };
+        
+        // A NaN no parameter is set to
+        static const uint32_t kApplied = 0xFFFFFFFF;
+        
+        static uint32_t toBits(FAUSTFLOAT value)
+        {
+            static_assert(sizeof(FAUSTFLOAT) == sizeof(uint32_t), "the values are exchanged as 32-bit words");
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+        static FAUSTFLOAT fromBits(uint32_t bits)
+        {
+            FAUSTFLOAT value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        event fEvents[PARAM_QUEUE_SIZE];
+        std::atomic<uint32_t> fWrite;   // published events, moved by the producer
+        std::atomic<uint32_t> fRead;    // drained events, moved by the consumer
+        std::atomic<uint32_t> fTime;    // next frame to compute, moved by the consumer
+        std::atomic<uint32_t> fClockSeq;    // odd while the consumer updates the clock reference
+        std::atomic<uint32_t> fClockFrame;
+        std::atomic<uint32_t> fClockUs;
+        uint32_t fHeld;                 // end of the held back events (producer)
+        int fGroup;                     // begin/end nesting (producer)
+
+    public:
+
+        paramqueue():fWrite(0), fRead(0), fTime(0), fClockSeq(0), fClockFrame(0), fClockUs(0), fHeld(0), fGroup(0) {}
+
+        // Producer side
+
+        // The date of the next frame to compute, for changes to be applied as soon as possible
+        uint32_t getTime() { return fTime.load(std::memory_order_acquire); }
+
+        // The date of the frame due at 'usec' on the clock of setClock, at 'srate'
+        uint32_t getDate(uint32_t usec, int srate)
+        {
+            uint32_t seq, frame, ref;
+            do {
+                seq = fClockSeq.load(std::memory_order_acquire);
+                frame = fClockFrame.load(std::memory_order_relaxed);
+                ref = fClockUs.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1) || seq != fClockSeq.load(std::memory_order_relaxed));
+            return frame + uint32_t((int64_t(int32_t(usec - ref)) * srate) / 1000000);
+        }
+
+        /*
+         Replaces the value of the last queued event of 'zone', if it is not
+         applied yet and would be applied at the same point as the change: the
+         events after it must not be due later than the change either.
+        */
+        bool coalesce(FAUSTFLOAT* zone, uint32_t bits, uint32_t date)
+        {
+            uint32_t time = getTime();
+            bool due = int32_t(date - time) <= 0;
+            uint32_t limit = (due) ? time : date;
+            uint32_t read = fRead.load(std::memory_order_acquire);
+            for (uint32_t i = fHeld; i != read;) {
+                event& ev = fEvents[--i & (PARAM_QUEUE_SIZE - 1)];
+                if (int32_t(ev.fDate - limit) > 0) return false;
+                if (ev.fZone != zone) continue;
+                if (ev.fDate != date && !(due && int32_t(ev.fDate - time) <= 0)) return false;
+                uint32_t old = ev.fValue.load(std::memory_order_relaxed);
+                return old != kApplied && ev.fValue.compare_exchange_strong(old, bits, std::memory_order_relaxed);
+            }
+            return false;
+        }
+        
+        // False if the queue is full, then to be tried again once the consumer has drained it
+        bool push(FAUSTFLOAT* zone, FAUSTFLOAT value, uint32_t date)
+        {
+            uint32_t bits = toBits(value);
+            if (coalesce(zone, bits, date)) return true;
+            if (fHeld - fRead.load(std::memory_order_acquire) >= PARAM_QUEUE_SIZE) return false;
+            event& ev = fEvents[fHeld & (PARAM_QUEUE_SIZE - 1)];
+            ev.fZone = zone;
+            ev.fValue.store(bits, std::memory_order_relaxed);
+            ev.fDate = date;
+            fHeld++;
+            if (fGroup == 0) publish();
+            return true;
+        }
+        bool push(FAUSTFLOAT* zone, FAUSTFLOAT value) { return push(zone, value, getTime()); }
+
+        void begin() { fGroup++; }
+        bool isHolding() { return fGroup > 0; }
+        void end()
+        {
+            if (fGroup > 0 && --fGroup == 0) publish();
+        }
+
+        // Makes the held back events visible to the consumer
+        void publish() { fWrite.store(fHeld, std::memory_order_release); }
+
+        // Consumer side
+
+        // The frame of date 'frame' is due at 'usec' (microseconds, modulo 2^32)
+        void setClock(uint32_t frame, uint32_t usec)
+        {
+            uint32_t seq = fClockSeq.load(std::memory_order_relaxed);
+            fClockSeq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            fClockFrame.store(frame, std::memory_order_relaxed);
+            fClockUs.store(usec, std::memory_order_relaxed);
+            fClockSeq.store(seq + 2, std::memory_order_release);
+        }
+
+        /*
+         Before computing the next 'count' frames: applies the events due
+         by then, in order, and returns the frames up to the date of the
+         next event if it falls within 'count', 'count' otherwise. The
+         frames are then computed and given to advance.
+        */
+        int apply(int count)
+        {
+            uint32_t time = fTime.load(std::memory_order_relaxed);
+            uint32_t read = fRead.load(std::memory_order_relaxed);
+            uint32_t write = fWrite.load(std::memory_order_acquire);
+            for (; read != write; read++) {
+                event& ev = fEvents[read & (PARAM_QUEUE_SIZE - 1)];
+                int32_t ahead = int32_t(ev.fDate - time);
+                if (ahead > 0) {
+                    count = std::min<int32_t>(count, ahead);
+                    break;
+                }
+                *ev.fZone = fromBits(ev.fValue.exchange(kApplied, std::memory_order_relaxed));
+            }
+            fRead.store(read, std::memory_order_release);
+            return count;
+        }
+
+        void advance(int frames)
+        {
+            fTime.store(fTime.load(std::memory_order_relaxed) + uint32_t(frames), std::memory_order_release);
+        }
+
+        // Everything at once whatever the dates, from the producer when there is no consumer running anymore
+        void flush()
+        {
+            publish();
+            uint32_t write = fWrite.load(std::memory_order_relaxed);
+            for (uint32_t read = fRead.load(std::memory_order_acquire); read != write; read++) {
+                event& ev = fEvents[read & (PARAM_QUEUE_SIZE - 1)];
+                *ev.fZone = fromBits(ev.fValue.exchange(kApplied, std::memory_order_relaxed));
+            }
+            fRead.store(write, std::memory_order_release);
+        }
+};
+
+// The ESP32 driver is only built for the board, the DSP and the tools in 'tools' also build on the host
+#ifdef ESP_PLATFORM
+
 class esp32audio : public audio {
     
+    public:
+    
+        // Block computation on the interleaved stereo int32 I2S frames
+        typedef void (*rawcompute)(void* arg, int count, const int32_t* input, int32_t* output);
+    
     private:
     
+        enum { kMeasureIdle, kMeasureRequested, kMeasureRunning };
+        enum { kStatsIdle, kStatsCopy, kStatsCopyReset };
+    
         int fSampleRate;
         int fBufferSize;
+        int fDMABufCount;
+        int fPriority;
+        int fBits;          // I2S sample width: 32, 24 (right aligned in 32-bit containers) or 16
         int fNumInputs;
         int fNumOutputs;
         float** fInChannel;
         float** fOutChannel;
+        int32_t* fFrames;   // interleaved I2S frames: read, processed and written back in place (int16_t with 16-bit samples)
+        dsparena fOwnArena;
+        dsparena* fArena;   // where the buffers above are
+        size_t fArenaMark;  // arena size before init
         TaskHandle_t fHandle;
+        QueueHandle_t fEventQueue;  // I2S driver events, with I2S_EVENT_QUEUE
         dsp* fDSP;
-        bool fRunning;
+        std::atomic<bool> fRunning;
+        std::atomic<bool> fExited;  // set by the audio task on its way out, see stop
+        float fCPULoad;     // smoothed proportion of the block period spent between i2s_read and i2s_write
+        audiostats fStats;
+        audiostats fStatsCopy;
+        std::atomic<int> fStatsRequest;
+        uint32_t fPeriodCycles; // block period in CPU cycles, 0 until calibrated
+        rawcompute fRawCompute;
+        void* fRawArg;
+        paramqueue* fParams;    // parameter changes, applied on the frame they are due
+        std::atomic<int> fMeasureState;
+        std::atomic<int> fMeasured;
+        int fMeasureFrames;
+        int fMeasureTimeout;
+        std::atomic<int> fOverruns;     // input blocks dropped by the DMA
+        std::atomic<int> fUnderruns;    // output blocks the DMA had to play without new data
+        std::atomic<bool> fXRunFade;
+        bool fFadeIn;                   // fade the next block in, after an xrun
+        int64_t fOnTime;                // esp_timer time of the last block that had to wait for the DMA
+        int fLateBlocks;                // blocks since fOnTime that did not wait
+    
+        // CPU cycle counter, microseconds where there is none
+        static inline uint32_t getCycles()
+        {
+        #ifdef __XTENSA__
+            uint32_t cycles;
+            __asm__ __volatile__("rsr %0, ccount" : "=a"(cycles));
+            return cycles;
+        #else
+            return uint32_t(esp_timer_get_time());
+        #endif
+        }
+    
+        /*
+         The cycle counter is converted to time against esp_timer over the first
+         100 ms, which also leaves the start-up blocks out of the statistics.
+        */
+        void calibrate(int64_t start_us, uint32_t start_cycles)
+        {
+            int64_t elapsed = esp_timer_get_time() - start_us;
+            if (elapsed < 100000) return;
+            float cycles_per_us = float(getCycles() - start_cycles) / float(elapsed);
+            fPeriodCycles = std::max<uint32_t>(1, uint32_t(cycles_per_us * 1e6f * float(fBufferSize) / float(fSampleRate)));
+            fStats.setPeriod(fPeriodCycles, cycles_per_us);
+            fStats.reset();
+        }
+    
+        // Timestamps in cycles: before i2s_read, after it, after the input conversion, the DSP, the output conversion and i2s_write
+        void updateStats(const uint32_t* t)
+        {
+            for (int p = audiostats::kReadWait; p <= audiostats::kWriteWait; p++) {
+                fStats.add(p, t[p + 1] - t[p]);
+            }
+            uint32_t busy = t[4] - t[1];
+            fStats.add(audiostats::kBusy, busy);
+            fStats.endBlock();
+            fCPULoad += 0.1f * (float(busy) / float(fPeriodCycles) - fCPULoad);
+            
+            int request = fStatsRequest;
+            if (request != kStatsIdle) {
+                fStatsCopy = fStats;
+                if (request == kStatsCopyReset) fStats.reset();
+                fStatsRequest = kStatsIdle;
+            }
+        }
+    
+        /*
+         Deadlines. The blocking I2S calls (or the driver events) return as
+         soon as the DMA has a buffer ready, so a block that had to wait is on
+         time and is the reference: the next blocks are due one period apart
+         after it. A block later than that by the DMA ring (all buffers but
+         the one in use) has lost data on the way.
+        */
+        int64_t getLateness(int64_t now)
+        {
+            return now - (fOnTime + (int64_t(fLateBlocks) * 1000000 * fBufferSize) / fSampleRate);
+        }
+    
+        void checkXRun(int64_t now, std::atomic<int>& counter)
+        {
+            if (getLateness(now) > (int64_t(fDMABufCount - 1) * 1000000 * fBufferSize) / fSampleRate) {
+                counter++;
+                fFadeIn = fXRunFade;
+                resyncEvents();
+                fOnTime = now;
+                fLateBlocks = 0;
+            }
+        }
+    
+        // After the blocking I2S call that paces the task, which started at 'before'
+        void clockBlock(int64_t before, int64_t now, std::atomic<int>& counter)
+        {
+            if ((now - before) * 8 * fSampleRate > int64_t(1000000) * fBufferSize) {
+                // Waited for more than 1/8 period
+                fOnTime = now;
+                fLateBlocks = 0;
+            } else {
+                fLateBlocks++;
+                checkXRun(now, counter);
+            }
+        }
+    
+        // The events queued during an xrun are for buffers long gone, or some were dropped by the driver
+        void resyncEvents()
+        {
+        #if I2S_EVENT_QUEUE
+            if (fEventQueue) xQueueReset(fEventQueue);
+        #endif
+        }
+    
+        // Sleep until the DMA completes a buffer of 'type' (I2S_EVENT_RX_DONE or I2S_EVENT_TX_DONE),
+        // false if the task was stopped meanwhile
+        bool waitEvent(int type)
+        {
+            i2s_event_t event;
+            while (fRunning) {
+                if (xQueueReceive(fEventQueue, &event, 100/portTICK_PERIOD_MS) != pdTRUE) continue;
+                if (event.type == type) return fRunning;
+                if (event.type == I2S_EVENT_DMA_ERROR) {
+                    fOverruns++;
+                    fFadeIn = fXRunFade;
+                    resyncEvents();
+                }
+            }
+            return false;
+        }
+    
+        /*
+         After the event of its buffer, a block is read or written without
+         waiting. If it is not all there, the event was a stale one: the queue
+         is resynced and the rest of the block is waited for.
+        */
+        void readBlock(size_t bytes)
+        {
+            size_t done = 0;
+            i2s_read((i2s_port_t)0, fFrames, bytes, &done, 0);
+            if (done < bytes) {
+                resyncEvents();
+                size_t rest = 0;
+                i2s_read((i2s_port_t)0, (char*)fFrames + done, bytes - done, &rest, portMAX_DELAY);
+            }
+        }
+    
+        void writeBlock(size_t bytes)
+        {
+            size_t done = 0;
+            i2s_write((i2s_port_t)0, fFrames, bytes, &done, 0);
+            if (done < bytes) {
+                resyncEvents();
+                size_t rest = 0;
+                i2s_write((i2s_port_t)0, (const char*)fFrames + done, bytes - done, &rest, portMAX_DELAY);
+            }
+        }
+    
+        // Bytes of a block in the I2S DMA buffers
+        size_t getFrameBytes()
+        {
+            return AUDIO_MAX_CHAN*((fBits == 16) ? sizeof(int16_t) : sizeof(int32_t))*fBufferSize;
+        }
+    
+        // Sample 'i' of the frames as read from I2S, to Q31
+        int32_t getSample(int i)
+        {
+            if (fBits == 16) return int32_t(uint32_t(((int16_t*)fFrames)[i]) << 16);
+            if (fBits == 24) return int32_t(uint32_t(fFrames[i]) << 8);
+            return fFrames[i];
+        }
+    
+        // Frames as read from I2S to Q31, in place: for the raw DSP, and for the float one with 24-bit samples
+        void framesToQ31()
+        {
+            int samples = AUDIO_MAX_CHAN*fBufferSize;
+            if (fBits == 24) {
+                // Whatever the DMA leaves in the top byte is shifted out
+                for (int i = 0; i < samples; i++) {
+                    fFrames[i] = int32_t(uint32_t(fFrames[i]) << 8);
+                }
+            } else if (fBits == 16) {
+                // Backwards, the int16 samples being in the first half of the buffer
+                const int16_t* frames16 = (const int16_t*)fFrames;
+                for (int i = samples - 1; i >= 0; i--) {
+                    fFrames[i] = int32_t(uint32_t(frames16[i]) << 16);
+                }
+            }
+        }
+    
+        // Q31 frames of the raw DSP to the I2S width, in place
+        void framesFromQ31()
+        {
+            int samples = AUDIO_MAX_CHAN*fBufferSize;
+            if (fBits == 24) {
+                for (int i = 0; i < samples; i++) {
+                    fFrames[i] >>= 8;
+                }
+            } else if (fBits == 16) {
+                int16_t* frames16 = (int16_t*)fFrames;
+                for (int i = 0; i < samples; i++) {
+                    frames16[i] = int16_t(fFrames[i] >> 16);
+                }
+            }
+        }
+    
+        // Linear fade in over the block, from silence, so that the step after the xrun does not click
+        template <typename T>
+        void fadeIn(T* frames)
+        {
+            for (int i = 0; i < fBufferSize; i++) {
+                for (int c = 0; c < AUDIO_MAX_CHAN; c++) {
+                    frames[i*AUDIO_MAX_CHAN + c] = T((int64_t(frames[i*AUDIO_MAX_CHAN + c]) * i) / fBufferSize);
+                }
+            }
+            fFadeIn = false;
+        }
+    
+        // Latency measure, on the frames just read: look for the impulse on the left input
+        void measureInput()
+        {
+            for (int i = 0; i < fBufferSize; i++) {
+                int32_t sample = getSample(i*AUDIO_MAX_CHAN);
+                if (sample > 0x08000000 || sample < -0x08000000) {
+                    fMeasured = fMeasureFrames + i;
+                    fMeasureState = kMeasureIdle;
+                    return;
+                }
+            }
+            fMeasureFrames += fBufferSize;
+            if (fMeasureFrames > fMeasureTimeout) {
+                fMeasureState = kMeasureIdle;
+            }
+        }
+    
+        // Latency measure, on the frames to write: an impulse in the first block, then silence
+        void measureOutput()
+        {
+            std::fill(fFrames, fFrames + AUDIO_MAX_CHAN*fBufferSize, 0);
+            if (fMeasureState == kMeasureRequested) {
+                if (fBits == 16) {
+                    ((int16_t*)fFrames)[0] = ((int16_t*)fFrames)[1] = 0x4000;
+                } else {
+                    fFrames[0] = fFrames[1] = 0x40000000 >> (32 - fBits);
+                }
+                fMeasureFrames = 0;
+                fMeasureState = kMeasureRunning;
+            }
+        }
+    
+        // Frames 'offset' to 'offset + count' of the block through the DSP
+        template <int INPUTS, int OUTPUTS>
+        void computeFrames(bool raw, int offset, int count)
+        {
+            if (raw) {
+                int32_t* frames = fFrames + AUDIO_MAX_CHAN*offset;
+                fRawCompute(fRawArg, count, frames, frames);
+            } else if (offset == 0) {
+                fDSP->compute(count, fInChannel, fOutChannel);
+            } else {
+                FAUSTFLOAT* inputs[AUDIO_MAX_CHAN];
+                FAUSTFLOAT* outputs[AUDIO_MAX_CHAN];
+                for (int i = 0; i < INPUTS; i++) inputs[i] = fInChannel[i] + offset;
+                for (int i = 0; i < OUTPUTS; i++) outputs[i] = fOutChannel[i] + offset;
+                fDSP->compute(count, inputs, outputs);
+            }
+        }
     
         template <int INPUTS, int OUTPUTS>
         void audioTask()
         {
+            // The raw DSP reads and writes the I2S frames without conversion
+            bool raw = (fRawCompute != nullptr) && (INPUTS == AUDIO_MAX_CHAN) && (OUTPUTS == AUDIO_MAX_CHAN);
+            size_t frame_bytes = getFrameBytes();
+            int64_t start_us = esp_timer_get_time();
+            uint32_t start_cycles = getCycles();
+            fPeriodCycles = 0;
+            uint32_t t[6];  // see updateStats
+            fOnTime = esp_timer_get_time();
+            fLateBlocks = 0;
+            fFadeIn = false;
             while (fRunning) {
+                t[0] = getCycles();
                 if (INPUTS > 0) {
                     // Read from the card
-                    int32_t samples_data_in[AUDIO_MAX_CHAN*fBufferSize];
+                    int64_t before = esp_timer_get_time();
+                #if I2S_EVENT_QUEUE
+                    if (!waitEvent(I2S_EVENT_RX_DONE)) break;
+                    readBlock(frame_bytes);
+                #else
                     size_t bytes_read = 0;
-                    i2s_read((i2s_port_t)0, &samples_data_in, AUDIO_MAX_CHAN*sizeof(float)*fBufferSize, &bytes_read, portMAX_DELAY);
+                    i2s_read((i2s_port_t)0, fFrames, frame_bytes, &bytes_read, portMAX_DELAY);
+                #endif
+                    t[1] = getCycles();
+                    clockBlock(before, esp_timer_get_time(), fOverruns);
+                    if (fMeasureState == kMeasureRunning) {
+                        measureInput();
+                    }
                     
-                    // Convert and copy inputs
-                    if (INPUTS == AUDIO_MAX_CHAN) {
-                        // if stereo
-                        for (int i = 0; i < fBufferSize; i++) {
-                            fInChannel[0][i] = (float)samples_data_in[i*AUDIO_MAX_CHAN]*DIV_S32;
-                            fInChannel[1][i] = (float)samples_data_in[i*AUDIO_MAX_CHAN+1]*DIV_S32;
-                        }
-                    } else {
-                        // otherwise only first channel
-                        for (int i = 0; i < fBufferSize; i++) {
-                            fInChannel[0][i] = (float)samples_data_in[i*AUDIO_MAX_CHAN]*DIV_S32;
+                    // Convert and copy inputs (if mono, only first channel)
+                    if (raw || fBits == 24) {
+                        framesToQ31();
+                    }
+                    if (!raw) {
+                        float* right = (INPUTS == AUDIO_MAX_CHAN) ? fInChannel[1] : nullptr;
+                        if (fBits == 16) {
+                            sampleconvert_s16_to_planar((const int16_t*)fFrames, fInChannel[0], right, fBufferSize);
+                        } else {
+                            sampleconvert_s32_to_planar(fFrames, fInChannel[0], right, fBufferSize);
                         }
                     }
+                } else {
+                    t[1] = t[0];
                 }
+                t[2] = getCycles();
                 
-                // Call DSP
-                fDSP->compute(fBufferSize, fInChannel, fOutChannel);
+                // Control callbacks run between two blocks
+            #if !I2S_EVENT_QUEUE
+                runControlCallbacks();
+            #endif
                 
-                // Convert and copy outputs
-                int32_t samples_data_out[AUDIO_MAX_CHAN*fBufferSize];
-                if (OUTPUTS == AUDIO_MAX_CHAN) {
-                    // if stereo
-                    for (int i = 0; i < fBufferSize; i++) {
-                        samples_data_out[i*AUDIO_MAX_CHAN] = clip(fOutChannel[0][i]);
-                        samples_data_out[i*AUDIO_MAX_CHAN+1] = clip(fOutChannel[1][i]);
+                // Call DSP, the raw one in place, in slices cut at the dates of the parameter changes
+                if (fParams) {
+                    // A change stamped while this block is computed is due in the next one, at the same offset
+                    fParams->setClock(fParams->getTime() + fBufferSize, uint32_t(esp_timer_get_time()));
+                    for (int offset = 0; offset < fBufferSize;) {
+                        int count = fParams->apply(fBufferSize - offset);
+                        computeFrames<INPUTS, OUTPUTS>(raw, offset, count);
+                        fParams->advance(count);
+                        offset += count;
                     }
                 } else {
-                    // otherwise only first channel
-                    for (int i = 0; i < fBufferSize; i++) {
-                        samples_data_out[i*AUDIO_MAX_CHAN] = clip(fOutChannel[0][i]);
-                        samples_data_out[i*AUDIO_MAX_CHAN+1] = samples_data_out[i*AUDIO_MAX_CHAN];
+                    computeFrames<INPUTS, OUTPUTS>(raw, 0, fBufferSize);
+                }
+                t[3] = getCycles();
+                
+                // Convert and copy outputs (if mono, first channel on both sides)
+                if (raw) {
+                    framesFromQ31();
+                } else {
+                    float* right = (OUTPUTS == AUDIO_MAX_CHAN) ? fOutChannel[1] : nullptr;
+                    if (fBits == 16) {
+                        sampleconvert_planar_to_s16(fOutChannel[0], right, (int16_t*)fFrames, fBufferSize);
+                    } else if (fBits == 24) {
+                        sampleconvert_planar_to_s24(fOutChannel[0], right, fFrames, fBufferSize);
+                    } else {
+                        sampleconvert_planar_to_s32(fOutChannel[0], right, fFrames, fBufferSize);
+                    }
+                }
+                t[4] = getCycles();
+                
+                // The output is paced by the input, unless there is none
+                int64_t before = esp_timer_get_time();
+                if (INPUTS > 0) {
+                    checkXRun(before, fUnderruns);
+                }
+                if (fFadeIn) {
+                    if (fBits == 16) {
+                        fadeIn((int16_t*)fFrames);
+                    } else {
+                        fadeIn(fFrames);
                     }
                 }
                 
+                if (INPUTS > 0 && fMeasureState != kMeasureIdle) {
+                    measureOutput();
+                }
+                
                 // Write to the card
+            #if I2S_EVENT_QUEUE
+                if (INPUTS == 0) {
+                    if (!waitEvent(I2S_EVENT_TX_DONE)) break;
+                    writeBlock(frame_bytes);
+                } else {
+                    // Paced by the input, the DMA has a free buffer for it
+                    size_t bytes_written = 0;
+                    i2s_write((i2s_port_t)0, fFrames, frame_bytes, &bytes_written, portMAX_DELAY);
+                }
+            #else
                 size_t bytes_written = 0;
-                i2s_write((i2s_port_t)0, &samples_data_out, AUDIO_MAX_CHAN*sizeof(float)*fBufferSize, &bytes_written, portMAX_DELAY);
+                i2s_write((i2s_port_t)0, fFrames, frame_bytes, &bytes_written, portMAX_DELAY);
+            #endif
+                t[5] = getCycles();
+                if (INPUTS == 0) {
+                    clockBlock(before, esp_timer_get_time(), fUnderruns);
+                }
+                
+                if (fPeriodCycles > 0) {
+                    updateStats(t);
+                } else {
+                    calibrate(start_us, start_cycles);
+                }
+                
+            #if I2S_EVENT_QUEUE
+                // While the DMA is busy with the block
+                runControlCallbacks();
+            #endif
             }
-            
-            // Task has to deleted itself beforee returning
-            vTaskDelete(nullptr);
         }
     
+        // Buffers are pieces of the arena, given back by rewinding it
         void destroy()
         {
-            for (int i = 0; i < fNumInputs; i++) {
-                delete[] fInChannel[i];
+            for (int i = 0; i < fNumInputs && fInChannel; i++) {
+                fArena->destroy(fInChannel[i]);
             }
-            delete [] fInChannel;
+            fArena->destroy(fInChannel);
+            fInChannel = nullptr;
             
-            for (int i = 0; i < fNumOutputs; i++) {
-                delete[] fOutChannel[i];
+            for (int i = 0; i < fNumOutputs && fOutChannel; i++) {
+                fArena->destroy(fOutChannel[i]);
             }
-            delete [] fOutChannel;
+            fArena->destroy(fOutChannel);
+            fOutChannel = nullptr;
+            
+            fArena->destroy(fFrames);
+            fFrames = nullptr;
+            
+            fArena->rewind(fArenaMark);
+        }
+    
+        template <typename T>
+        T* allocate(int count)
+        {
+            return static_cast<T*>(fArena->allocate(sizeof(T)*count));
         }
     
         static void audioTaskHandler(void* arg)
         {
             esp32audio* audio = static_cast<esp32audio*>(arg);
             
+            // FTZ/DAZ are per thread, so they are set by the audio task itself (no-op without SSE)
+            AVOIDDENORMALS;
+            
             if (audio->fNumInputs == 0 && audio->fNumOutputs == 1) {
                 audio->audioTask<0,1>();
             } else if (audio->fNumInputs == 0 && audio->fNumOutputs == 2) {
@@ -885,20 +1570,59 @@ class esp32audio : public audio {
             } else if (audio->fNumInputs == 2 && audio->fNumOutputs == 2) {
                 audio->audioTask<2,2>();
             }
+            
+            // Nothing of the object is touched after this, stop may return and it may be deleted
+            audio->fExited = true;
+            // Task has to deleted itself beforee returning
+            vTaskDelete(nullptr);
         }
     
     public:
     
-        esp32audio(int srate, int bsize):
+        /*
+         'dma_count' I2S DMA buffers of 'bsize' frames in each direction, and the
+         priority of the audio task: fewer buffers give less latency (see
+         getLatency) but less margin when the task is late. 'bits' is the I2S
+         sample width, 32, 24 or 16: 16-bit samples halve the DMA buffers and
+         the bit clock, the codec has to be set to the same word size.
+         The channel buffers are taken from 'arena' when given, which then
+         has to have getArenaSize bytes left for init, or from an arena of
+         their own.
+        */
+        esp32audio(int srate, int bsize, int dma_count = 3, int priority = 24, int bits = 32, dsparena* arena = nullptr):
         fSampleRate(srate),
         fBufferSize(bsize),
+        fDMABufCount(dma_count),
+        fPriority(priority),
+        fBits((bits == 16 || bits == 24) ? bits : 32),
         fNumInputs(0),
         fNumOutputs(0),
         fInChannel(nullptr),
         fOutChannel(nullptr),
+        fFrames(nullptr),
+        fArena((arena) ? arena : &fOwnArena),
+        fArenaMark(SIZE_MAX),
         fHandle(nullptr),
+        fEventQueue(nullptr),
         fDSP(nullptr),
-        fRunning(false)
+        fRunning(false),
+        fExited(true),
+        fCPULoad(0.f),
+        fStatsRequest(kStatsIdle),
+        fPeriodCycles(0),
+        fRawCompute(nullptr),
+        fRawArg(nullptr),
+        fParams(nullptr),
+        fMeasureState(kMeasureIdle),
+        fMeasured(-1),
+        fMeasureFrames(0),
+        fMeasureTimeout(0),
+        fOverruns(0),
+        fUnderruns(0),
+        fXRunFade(true),
+        fFadeIn(false),
+        fOnTime(0),
+        fLateBlocks(0)
         {
             i2s_pin_config_t pin_config;
         #if TTGO_TAUDIO
@@ -935,11 +1659,11 @@ class esp32audio : public audio {
             i2s_config_t i2s_config = {
                 .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_RX),
                 .sample_rate = fSampleRate,
-                .bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT,
+                .bits_per_sample = (i2s_bits_per_sample_t)fBits,
                 .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
                 .communication_format = (i2s_comm_format_t)(I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB),
                 .intr_alloc_flags = ESP_INTR_FLAG_LEVEL3, // high interrupt priority
-                .dma_buf_count = 3,
+                .dma_buf_count = fDMABufCount,
                 .dma_buf_len = fBufferSize,
                 .use_apll = true
             };
@@ -947,16 +1671,21 @@ class esp32audio : public audio {
             i2s_config_t i2s_config = {
                 .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_RX),
                 .sample_rate = fSampleRate,
-                .bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT,
+                .bits_per_sample = (i2s_bits_per_sample_t)fBits,
                 .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
                 .communication_format = (i2s_comm_format_t)(I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB),
                 .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1, // high interrupt priority
-                .dma_buf_count = 3,
+                .dma_buf_count = fDMABufCount,
                 .dma_buf_len = fBufferSize,
                 .use_apll = false
             };
         #endif
+        #if I2S_EVENT_QUEUE
+            // A done event per DMA buffer and direction, twice over
+            i2s_driver_install((i2s_port_t)0, &i2s_config, 4*fDMABufCount, &fEventQueue);
+        #else
             i2s_driver_install((i2s_port_t)0, &i2s_config, 0, nullptr);
+        #endif
             i2s_set_pin((i2s_port_t)0, &pin_config);
             PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, FUNC_GPIO0_CLK_OUT1);
             REG_WRITE(PIN_CTRL, 0xFFFFFFF0);
@@ -964,6 +1693,7 @@ class esp32audio : public audio {
     
         virtual ~esp32audio()
         {
+            stop();
             destroy();
         }
     
@@ -977,56 +1707,588 @@ class esp32audio : public audio {
             
             fDSP->init(fSampleRate);
             
+            // A block of our own when not given one, the same from one init to the next if large enough
+            if (fArena == &fOwnArena) {
+                fOwnArena.reserve(getArenaSize(fNumInputs, fNumOutputs, fBufferSize));
+            }
+            fArenaMark = fArena->getUsed();
+            
             if (fNumInputs > 0) {
-                fInChannel = new FAUSTFLOAT*[fNumInputs];
+                fInChannel = allocate<FAUSTFLOAT*>(fNumInputs);
                 for (int i = 0; i < fNumInputs; i++) {
-                    fInChannel[i] = new FAUSTFLOAT[fBufferSize];
+                    fInChannel[i] = allocate<FAUSTFLOAT>(fBufferSize);
                 }
-            } else {
-                fInChannel = nullptr;
             }
             
             if (fNumOutputs > 0) {
-                fOutChannel = new FAUSTFLOAT*[fNumOutputs];
+                fOutChannel = allocate<FAUSTFLOAT*>(fNumOutputs);
                 for (int i = 0; i < fNumOutputs; i++) {
-                    fOutChannel[i] = new FAUSTFLOAT[fBufferSize];
+                    fOutChannel[i] = allocate<FAUSTFLOAT>(fBufferSize);
                 }
-            } else {
-                fOutChannel = nullptr;
             }
             
+            // Rather than on the 4 KB audio task stack, int32 frames whatever the I2S width for the raw DSP
+            fFrames = allocate<int32_t>(AUDIO_MAX_CHAN*fBufferSize);
+            std::fill(fFrames, fFrames + AUDIO_MAX_CHAN*fBufferSize, 0);
+            
             return true;
         }
     
-        virtual bool start()
+        // Arena bytes used by init, see the constructor
+        static size_t getArenaSize(int inputs, int outputs, int bsize)
         {
-            if (!fRunning) {
-                fRunning = true;
-                return (xTaskCreatePinnedToCore(audioTaskHandler, "Faust DSP Task", 4096, (void*)this, 24, &fHandle, 0) == pdPASS);
-            } else {
-                return true;
-            }
+            return audio_arena_size(inputs, outputs, bsize);
         }
     
+        // Use 'fun' instead of the DSP compute for stereo, to be set before start
+        void setRawCompute(rawcompute fun, void* arg)
+        {
+            fRawCompute = fun;
+            fRawArg = arg;
+        }
+    
+        // Queue of the parameter changes of the control loop, drained by the audio task, to be set before start
+        void setParamQueue(paramqueue* params) { fParams = params; }
+    
+        virtual bool start()
+        {
+            if (!fRunning) {
+                fRunning = true;
+                fExited = false;
+                if (xTaskCreatePinnedToCore(audioTaskHandler, "Faust DSP Task", 4096, (void*)this, fPriority, &fHandle, 0) != pdPASS) {
+                    fRunning = false;
+                    fExited = true;
+                    fHandle = nullptr;
+                    return false;
+                }
+                return true;
+            } else {
+                return true;
+            }
+        }
+    
+        // Returns once the audio task has exited, after the block it is computing
         virtual void stop()
         {
             if (fRunning) {
                 fRunning = false;
-                vTaskDelay(1/portTICK_PERIOD_MS);
+                while (!fExited) {
+                    vTaskDelay(1);
+                }
                 fHandle = nullptr;
             }
         }
     
         virtual int getBufferSize() { return fBufferSize; }
         virtual int getSampleRate() { return fSampleRate; }
+        int getBits() { return fBits; }
+        bool isRunning() { return fRunning; }
 
         virtual int getNumInputs() { return AUDIO_MAX_CHAN; }
         virtual int getNumOutputs() { return AUDIO_MAX_CHAN; }
     
         // Returns the average proportion of available CPU being spent inside the audio callbacks (between 0 and 1.0).
-        virtual float getCPULoad() { return 0.f; }
+        virtual float getCPULoad() { return fCPULoad; }
+    
+        // Input to output latency of the I2S buffering in frames: one input DMA buffer to fill, then the output DMA buffers ahead
+        int getLatency() { return (fDMABufCount + 1) * fBufferSize; }
+    
+        /*
+         Measured input to output latency in frames, including the codec: the
+         outputs play an impulse (the DSP is muted meanwhile) and the frames are
+         counted until it comes back on the left input, which has to be patched
+         to an output. Returns -1 if it is not heard within 'timeout' frames.
+         Blocks the caller, not to be called from the audio task.
+        */
+        int measureLatency(int timeout)
+        {
+            if (!fRunning || fNumInputs == 0) return -1;
+            fMeasured = -1;
+            fMeasureTimeout = timeout;
+            fMeasureState = kMeasureRequested;
+            while (fRunning && fMeasureState != kMeasureIdle) {
+                vTaskDelay(10/portTICK_PERIOD_MS);
+            }
+            fMeasureState = kMeasureIdle;
+            return fMeasured;
+        }
+    
+        virtual int getXRuns() { return fOverruns + fUnderruns; }
+        int getOverruns() { return fOverruns; }
+        int getUnderruns() { return fUnderruns; }
+    
+        // Fade the output in after an xrun (on by default), rather than going on from where the DSP stands
+        void setXRunFade(bool fade) { fXRunFade = fade; }
+    
+        /*
+         Copy of the timing statistics of the audio task, which makes it at
+         the end of the next block, then resets its own if 'reset' is true.
+         Blocks the caller, not to be called from the audio task. Returns false
+         if the statistics are not ready yet (calibration of the first 100 ms).
+        */
+        bool getStats(audiostats& stats, bool reset)
+        {
+            if (!fRunning || fPeriodCycles == 0) return false;
+            fStatsRequest = (reset) ? kStatsCopyReset : kStatsCopy;
+            while (fRunning && fStatsRequest != kStatsIdle) {
+                vTaskDelay(1);
+            }
+            if (fStatsRequest != kStatsIdle) {
+                fStatsRequest = kStatsIdle;
+                return false;
+            }
+            stats = fStatsCopy;
+            return true;
+        }
+    
+};
+
+#endif // ESP_PLATFORM
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * Host audio driver, to run the DSP and its control callbacks on Linux.
+ *
+ * Frames are raw interleaved stereo int32 PCM, the 32-bit I2S format of
+ * esp32audio, read from and written to files, pipes or FIFOs ("-" being
+ * stdin and stdout). The audio thread computes blocks of the same size as
+ * on the board and runs the control callbacks after each write.
+ *
+ * - kHostRealTime: the thread asks for SCHED_FIFO and is paced like the I2S
+ *   driver, by the input when it is a pipe or a FIFO (as by i2s_read),
+ *   otherwise by the monotonic clock. A block started more than a period
+ *   after it was due counts as an xrun.
+ * - kHostFile: blocks are computed as fast as possible, to render files.
+ *
+ * The thread stops by itself at the end of the input, or after the number of
+ * frames given to the constructor, and calls the shutdown callback. Opening a
+ * FIFO in init blocks until its other end is opened.
+ */
+
+enum { kHostRealTime, kHostFile };
+
+class linuxaudio : public audio {
+    
+    private:
+    
+        enum { kStatsIdle, kStatsCopy, kStatsCopyReset };
+    
+        int fSampleRate;
+        int fBufferSize;
+        int fMode;
+        int fPriority;
+        std::string fInputPath;
+        std::string fOutputPath;
+        int fInput;             // -1 for silence
+        int fOutput;            // -1 to discard the output
+        bool fInputPaced;       // the input is a pipe or a FIFO
+        int64_t fFrames;        // frames to compute, -1 up to the end of the input
+        int64_t fDone;          // frames computed so far
+        int fNumInputs;
+        int fNumOutputs;
+        float** fInChannel;
+        float** fOutChannel;
+        int32_t* fBlock;        // interleaved frames, read, converted and written back in place
+        dsparena fArena;
+        dsp* fDSP;
+        pthread_t fThread;
+        bool fStarted;
+        bool fRealTime;         // the thread got SCHED_FIFO
+        std::atomic<bool> fRunning;
+        std::atomic<bool> fFinished;
+        float fCPULoad;
+        audiostats fStats;
+        audiostats fStatsCopy;
+        std::atomic<int> fStatsRequest;
+        std::atomic<int> fOverruns;
+        std::atomic<int> fUnderruns;
+        int64_t fDue;           // time the next block is due at, in ns
+    
+        static int64_t getTime()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+    
+        int64_t getPeriod() { return (int64_t(1000000000) * fBufferSize) / fSampleRate; }
+    
+        static int openPath(const std::string& path, bool input)
+        {
+            if (path.empty()) return -1;
+            if (path == "-") return (input) ? STDIN_FILENO : STDOUT_FILENO;
+            return (input) ? open(path.c_str(), O_RDONLY) : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+    
+        void closePaths()
+        {
+            if (fInput > STDERR_FILENO) close(fInput);
+            if (fOutput > STDERR_FILENO) close(fOutput);
+            fInput = fOutput = -1;
+        }
+    
+        // Fills 'count' frames from the input, waiting for them, returns fewer at the end of the input
+        int readFrames(int count)
+        {
+            char* data = (char*)fBlock;
+            size_t size = sizeof(int32_t)*AUDIO_MAX_CHAN*count;
+            size_t done = 0;
+            while (done < size && fRunning) {
+                // Woken up from time to time to see stop()
+                struct pollfd pfd = { fInput, POLLIN, 0 };
+                if (poll(&pfd, 1, 100) == 0) continue;
+                ssize_t res = read(fInput, data + done, size - done);
+                if (res > 0) {
+                    done += res;
+                } else if (res == 0 || errno != EINTR) {
+                    break;
+                }
+            }
+            return int(done / (sizeof(int32_t)*AUDIO_MAX_CHAN));
+        }
+    
+        bool writeFrames(int count)
+        {
+            const char* data = (const char*)fBlock;
+            size_t size = sizeof(int32_t)*AUDIO_MAX_CHAN*count;
+            size_t done = 0;
+            while (done < size) {
+                ssize_t res = write(fOutput, data + done, size - done);
+                if (res > 0) {
+                    done += res;
+                } else if (res < 0 && errno != EINTR) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    
+        // Same timestamps as esp32audio::updateStats, in ns
+        void updateStats(const uint32_t* t)
+        {
+            for (int p = audiostats::kReadWait; p <= audiostats::kWriteWait; p++) {
+                fStats.add(p, t[p + 1] - t[p]);
+            }
+            uint32_t busy = t[4] - t[1];
+            fStats.add(audiostats::kBusy, busy);
+            fStats.endBlock();
+            fCPULoad += 0.1f * (float(busy) / float(getPeriod()) - fCPULoad);
+            
+            int request = fStatsRequest;
+            if (request != kStatsIdle) {
+                fStatsCopy = fStats;
+                if (request == kStatsCopyReset) fStats.reset();
+                fStatsRequest = kStatsIdle;
+            }
+        }
+    
+        // Real time pacing of a block, before its computation
+        void clockBlock(int64_t before, int64_t now)
+        {
+            int64_t period = getPeriod();
+            if (fInputPaced && (now - before) * 8 > period) {
+                // Waited for the input, the block is on time
+                fDue = now;
+            } else if (now - fDue > period) {
+                (fInputPaced ? fOverruns : fUnderruns)++;
+                fDue = now;
+            }
+            fDue += period;
+        }
+    
+        void audioTask()
+        {
+            uint32_t t[6];  // see updateStats
+            int64_t period = getPeriod();
+            fStats.setPeriod(uint32_t(period), 1000.f);
+            fStats.reset();
+            fDue = getTime();
+            bool ended = false;
+            std::string message = "end of input";
+            
+            while (fRunning) {
+                int count = fBufferSize;
+                if (fFrames >= 0) {
+                    count = int(std::min<int64_t>(count, fFrames - fDone));
+                    if (count <= 0) break;
+                }
+                
+                int64_t before = getTime();
+                t[0] = uint32_t(before);
+                if (fInput >= 0 && !ended) {
+                    int got = readFrames(count);
+                    if (got < count) {
+                        if (!fRunning) break;
+                        if (fFrames < 0) {
+                            // End of the input, its last frames if any
+                            if (got == 0) break;
+                            count = got;
+                            fRunning = false;
+                        } else {
+                            // Silence after it, up to 'frames', paced by the clock
+                            std::fill(fBlock + AUDIO_MAX_CHAN*got, fBlock + AUDIO_MAX_CHAN*fBufferSize, 0);
+                            ended = true;
+                            fInputPaced = false;
+                        }
+                    }
+                } else {
+                    std::fill(fBlock, fBlock + AUDIO_MAX_CHAN*fBufferSize, 0);
+                }
+                if (fMode == kHostRealTime && !fInputPaced) {
+                    struct timespec ts = { time_t(fDue / 1000000000), long(fDue % 1000000000) };
+                    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+                }
+                int64_t now = getTime();
+                t[1] = uint32_t(now);
+                if (fMode == kHostRealTime) {
+                    clockBlock(before, now);
+                }
+                
+                // Convert and copy inputs (if mono, only first channel)
+                if (fNumInputs > 0) {
+                    sampleconvert_s32_to_planar(fBlock, fInChannel[0], (fNumInputs == AUDIO_MAX_CHAN) ? fInChannel[1] : nullptr, count);
+                }
+                t[2] = uint32_t(getTime());
+                
+                fDSP->compute(count, fInChannel, fOutChannel);
+                t[3] = uint32_t(getTime());
+                
+                // Convert and copy outputs (if mono, first channel on both sides)
+                sampleconvert_planar_to_s32(fOutChannel[0], (fNumOutputs == AUDIO_MAX_CHAN) ? fOutChannel[1] : nullptr, fBlock, count);
+                t[4] = uint32_t(getTime());
+                
+                if (fOutput >= 0 && !writeFrames(count)) {
+                    message = std::string("output: ") + strerror(errno);
+                    break;
+                }
+                t[5] = uint32_t(getTime());
+                fDone += count;
+                
+                updateStats(t);
+                
+                // While the output plays the block
+                runControlCallbacks();
+            }
+            
+            fRunning = false;
+            fFinished = true;
+            if (fShutdown) fShutdown(message.c_str(), fShutdownArg);
+        }
+    
+        static void* audioTaskHandler(void* arg)
+        {
+            // FTZ/DAZ are per thread, so they are set by the audio thread itself
+            AVOIDDENORMALS;
+            static_cast<linuxaudio*>(arg)->audioTask();
+            return nullptr;
+        }
+    
+        void destroy()
+        {
+            for (int i = 0; i < fNumInputs && fInChannel; i++) {
+                fArena.destroy(fInChannel[i]);
+            }
+            fArena.destroy(fInChannel);
+            fInChannel = nullptr;
+            
+            for (int i = 0; i < fNumOutputs && fOutChannel; i++) {
+                fArena.destroy(fOutChannel[i]);
+            }
+            fArena.destroy(fOutChannel);
+            fOutChannel = nullptr;
+            
+            fArena.destroy(fBlock);
+            fBlock = nullptr;
+        }
+    
+        template <typename T>
+        T* allocate(int count)
+        {
+            return static_cast<T*>(fArena.allocate(sizeof(T)*count));
+        }
+    
+    public:
+    
+        /*
+         Blocks of 'bsize' frames from 'input' to 'output', paths of raw
+         stereo int32 PCM: "-" for stdin or stdout, an empty path for silence
+         in, or for no output. 'frames' limits the frames computed, past the
+         end of the input if need be (-1 to stop at the end of the input, and
+         the length of the render without input). 'priority' is the
+         SCHED_FIFO priority of the real-time mode.
+        */
+        linuxaudio(int srate, int bsize, const std::string& input, const std::string& output,
+                   int mode = kHostRealTime, int64_t frames = -1, int priority = 70):
+        fSampleRate(srate),
+        fBufferSize(bsize),
+        fMode(mode),
+        fPriority(priority),
+        fInputPath(input),
+        fOutputPath(output),
+        fInput(-1),
+        fOutput(-1),
+        fInputPaced(false),
+        fFrames(frames),
+        fDone(0),
+        fNumInputs(0),
+        fNumOutputs(0),
+        fInChannel(nullptr),
+        fOutChannel(nullptr),
+        fBlock(nullptr),
+        fDSP(nullptr),
+        fStarted(false),
+        fRealTime(false),
+        fRunning(false),
+        fFinished(false),
+        fCPULoad(0.f),
+        fStatsRequest(kStatsIdle),
+        fOverruns(0),
+        fUnderruns(0),
+        fDue(0)
+        {}
+    
+        virtual ~linuxaudio()
+        {
+            stop();
+            closePaths();
+            destroy();
+        }
+    
+        virtual bool init(const char* name, dsp* dsp)
+        {
+            destroy();
+            closePaths();
+            
+            fDSP = dsp;
+            fNumInputs = fDSP->getNumInputs();
+            fNumOutputs = fDSP->getNumOutputs();
+            if (fNumOutputs < 1 || fNumInputs > AUDIO_MAX_CHAN || fNumOutputs > AUDIO_MAX_CHAN) return false;
+            
+            fDSP->init(fSampleRate);
+            
+            fArena.reserve(audio_arena_size(fNumInputs, fNumOutputs, fBufferSize));
+            if (fNumInputs > 0) {
+                fInChannel = allocate<FAUSTFLOAT*>(fNumInputs);
+                for (int i = 0; i < fNumInputs; i++) {
+                    fInChannel[i] = allocate<FAUSTFLOAT>(fBufferSize);
+                }
+            }
+            fOutChannel = allocate<FAUSTFLOAT*>(fNumOutputs);
+            for (int i = 0; i < fNumOutputs; i++) {
+                fOutChannel[i] = allocate<FAUSTFLOAT>(fBufferSize);
+            }
+            fBlock = allocate<int32_t>(AUDIO_MAX_CHAN*fBufferSize);
+            std::fill(fBlock, fBlock + AUDIO_MAX_CHAN*fBufferSize, 0);
+            
+            fInput = openPath(fInputPath, true);
+            fOutput = openPath(fOutputPath, false);
+            if ((!fInputPath.empty() && fInput < 0) || (!fOutputPath.empty() && fOutput < 0)) {
+                closePaths();
+                return false;
+            }
+            struct stat st;
+            fInputPaced = (fInput >= 0 && fstat(fInput, &st) == 0 && S_ISFIFO(st.st_mode));
+            fDone = 0;
+            return true;
+        }
+    
+        virtual bool start()
+        {
+            if (fStarted) return true;
+            fRunning = true;
+            fFinished = false;
+            fRealTime = false;
+            if (fMode == kHostRealTime) {
+                pthread_attr_t attr;
+                struct sched_param param;
+                param.sched_priority = fPriority;
+                pthread_attr_init(&attr);
+                pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+                pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+                pthread_attr_setschedparam(&attr, &param);
+                fRealTime = (pthread_create(&fThread, &attr, audioTaskHandler, this) == 0);
+                pthread_attr_destroy(&attr);
+            }
+            // Without the rights for SCHED_FIFO (see RLIMIT_RTPRIO), or in file mode
+            fStarted = fRealTime || (pthread_create(&fThread, nullptr, audioTaskHandler, this) == 0);
+            fRunning = fStarted;
+            return fStarted;
+        }
+    
+        // Returns once the audio thread has exited
+        virtual void stop()
+        {
+            if (fStarted) {
+                fRunning = false;
+                pthread_join(fThread, nullptr);
+                fStarted = false;
+            }
+        }
+    
+        // Waits for the end of the input (or of the frames to compute), then stops
+        void wait()
+        {
+            if (fStarted) {
+                pthread_join(fThread, nullptr);
+                fStarted = false;
+            }
+        }
+    
+        bool isRunning() { return fRunning; }
+        bool isRealTime() { return fRealTime; }
+        int64_t getFrames() { return fDone; }
+    
+        virtual int getBufferSize() { return fBufferSize; }
+        virtual int getSampleRate() { return fSampleRate; }
+    
+        virtual int getNumInputs() { return AUDIO_MAX_CHAN; }
+        virtual int getNumOutputs() { return AUDIO_MAX_CHAN; }
+    
+        // Returns the average proportion of available CPU being spent inside the audio callbacks (between 0 and 1.0).
+        virtual float getCPULoad() { return fCPULoad; }
+    
+        virtual int getXRuns() { return fOverruns + fUnderruns; }
+        int getOverruns() { return fOverruns; }
+        int getUnderruns() { return fUnderruns; }
+    
+        /*
+         Copy of the timing statistics of the audio thread, made at the end of
+         the next block, see esp32audio::getStats. Once the thread has exited,
+         the statistics of the whole run.
+        */
+        bool getStats(audiostats& stats, bool reset)
+        {
+            if (fFinished) {
+                stats = fStats;
+                if (reset) fStats.reset();
+                return true;
+            }
+            if (!fRunning) return false;
+            fStatsRequest = (reset) ? kStatsCopyReset : kStatsCopy;
+            while (fRunning && fStatsRequest != kStatsIdle) {
+                usleep(1000);
+            }
+            if (fStatsRequest != kStatsIdle) {
+                fStatsRequest = kStatsIdle;
+                return getStats(stats, reset);
+            }
+            stats = fStatsCopy;
+            return true;
+        }
     
 };
+
+#endif // __linux__
 					
 #endif
 /**************************  END  esp32audio.h **************************/
@@ -10036,24 +11298,218 @@ struct dsp_poly_factory : public dsp_factory {
 #include <cmath>
 #include <math.h>
 
+/*
+ State layout: with RING_STATE 1 the one sample histories of compute are held
+ in locals for the whole block and the resonator banks alternate between two
+ state arrays, instead of shifting every history in memory each sample. 0
+ selects the layout generated by Faust; both give the same output bit for bit.
+ The block pipeline below always keeps its histories in locals.
+*/
+#ifndef RING_STATE
+#define RING_STATE 1
+#endif
+
+/*
+ Block pipeline: with BLOCK_PIPELINE 1, compute runs in slices of at most
+ BLOCK_PIPELINE_SIZE frames and each slice goes through separate stages, each
+ one a tight loop over the slice: decay poles, gain smoothers, input filters,
+ resonator banks, then the output mix and soft clipper, which has no recursion
+ and can be vectorized. The per-sample arithmetic is the same as the fused
+ loop (BLOCK_PIPELINE 0), so the output is identical. The stage buffers
+ (fZecN) are members, to keep them off the 4 KB audio task stack.
+*/
+#ifndef BLOCK_PIPELINE
+#define BLOCK_PIPELINE 1
+#endif
+
+#ifndef BLOCK_PIPELINE_SIZE
+#define BLOCK_PIPELINE_SIZE 32
+#endif
+
+/*
+ Fixed-point engine: with FIXED_POINT 1, mydsp also gets computeQ31, which
+ runs the same graph in integer arithmetic (see q31bank.h) on interleaved
+ stereo int32 frames, as read from and written to I2S, and the ESP32 audio
+ task uses it instead of compute and the float conversions. Only the control
+ rate values (parameters, decay pole) are still computed in float. The output
+ stays within about -75 dBFS RMS of the float engine, see
+ tools/compare_q31.cpp.
+*/
+#ifndef FIXED_POINT
+#define FIXED_POINT 0
+#endif
+
+#include "modalbank.h"
+#if FIXED_POINT
+#include "q31bank.h"
+#endif
+
 static float mydsp_faustpower2_f(float value) {
 	return (value * value);
 }
 
-#ifndef FAUSTCLASS 
-#define FAUSTCLASS mydsp
+/*
+ Decay pole radius of pm.modeFilter for a given T60 (in seconds), with the
+ 0.05 s floor added in Wingie.dsp. The pow is evaluated at control rate, once
+ every DECAY_SUBBLOCK samples, and linearly interpolated in between.
+ DECAY_SUBBLOCK 1 is bit-exact with the per-sample code. With the default of 8
+ the output error stays below -60 dB RMS relative to the per-sample version;
+ the largest deviations (about -50 dBFS peak) happen during the 2 ms
+ mode_changed attack, where the pole moves fastest.
+*/
+#ifndef DECAY_SUBBLOCK
+#define DECAY_SUBBLOCK 8
 #endif
 
-#ifdef __APPLE__ 
-#define exp10f __exp10f
-#define exp10 __exp10
+/*
+ Denormal protection for targets without FTZ/DAZ (and as a safety net when
+ the audio thread did not set them): at the end of each block, recursive
+ states that have decayed under 1e-30 are set to zero, before they can reach
+ the subnormal range (< 1.2e-38) within the next block. The resonator banks
+ snap their own state when they are culled (see modalbank.h).
+*/
+#ifndef DENORMAL_SNAP
+#define DENORMAL_SNAP 1
 #endif
 
-class mydsp : public dsp {
+static inline void mydsp_snap(float& x) {
+	x = ((std::fabs(x) < 1e-30f) ? 0.0f : x);
+}
+
+static float mydsp_decay_pole(float inv_sample_rate, float t60) {
+	return std::pow(0.00100000005f, (inv_sample_rate / (t60 + 0.0500000007f)));
+}
+
+/*
+ Mode frequencies of f(note, n, s) in Wingie.dsp, for route s = 0 (bar),
+ 1 (int), 2 (serge) and 3 (poly). 'note_ratio' and 'poly_ratio' are the
+ ba.midikey2hz ratios to 440 Hz of note0/note1 and of poly_note_0..2.
+ The first 9 modes use the constants folded by the Faust compiler; above
+ that, bar and int follow their formula, serge keeps doubling and poly
+ continues the harmonic series of each of its three notes.
+*/
+#ifndef NHARMONICS
+#define NHARMONICS 9
+#endif
+
+static_assert(NHARMONICS <= MODALBANK_MAX_MODES, "NHARMONICS must not exceed MODALBANK_MAX_MODES");
+static_assert((BLOCK_PIPELINE_SIZE % DECAY_SUBBLOCK) == 0, "BLOCK_PIPELINE_SIZE must be a multiple of DECAY_SUBBLOCK");
+
+static const float mydsp_bar_ratios[9] = {439.995605f, 1222.20996f, 2395.53149f, 3959.96045f, 5915.49658f, 8262.13965f, 10999.8896f, 14128.748f, 17648.7129f};
+static const float mydsp_serge[9] = {62.0f, 115.0f, 218.0f, 411.0f, 777.0f, 1500.0f, 2800.0f, 5200.0f, 11000.0f};
+
+static float mydsp_mode_freq(float route, int n, float note_ratio, const float* poly_ratio) {
+	if (route >= 2.0f) {
+		if (route >= 3.0f) {
+			return (float(440 * (((n % 3) + 1) + (3 * (n / 9)))) * poly_ratio[((n / 3) % 3)]);
+		} else {
+			return ((n < 9) ? mydsp_serge[n] : (11000.0f * float(1 << std::min<int>((n - 8), 16))));
+		}
+	} else if (route >= 1.0f) {
+		return (float(440 * (n + 1)) * note_ratio);
+	} else {
+		return (((n < 9) ? mydsp_bar_ratios[n] : (195.553604f * mydsp_faustpower2_f((float(n) + 1.5f)))) * note_ratio);
+	}
+}
+
+/*
+ cos(2*pi*freq/SR) of every mode, for every integer note of the note0/note1
+ and poly_note sliders (12 to 96), filled in classInit for the current sample
+ rate. Poly mode k of a note is int mode k of the same note, so poly has no
+ table of its own. Fractional or out of range notes are computed directly.
+*/
+#define MYDSP_NOTE_MIN 12
+#define MYDSP_NOTE_MAX 96
+
+static float mydsp_cos_bar[MYDSP_NOTE_MAX - MYDSP_NOTE_MIN + 1][MODALBANK_MAX_MODES];
+static float mydsp_cos_int[MYDSP_NOTE_MAX - MYDSP_NOTE_MIN + 1][MODALBANK_MAX_MODES];
+static float mydsp_cos_serge[MODALBANK_MAX_MODES];
+
+static float mydsp_note_ratio(float note) {
+	return std::pow(2.0f, (0.0833333358f * (note + -69.0f)));
+}
+
+static float mydsp_mode_cos_compute(float w, float route, int n, float note, const float* poly_note) {
+	float poly_ratio[3] = {mydsp_note_ratio(poly_note[0]), mydsp_note_ratio(poly_note[1]), mydsp_note_ratio(poly_note[2])};
+	return std::cos((w * std::min<float>(mydsp_mode_freq(route, n, mydsp_note_ratio(note), poly_ratio), 16000.0f)));
+}
+
+static void mydsp_fill_cos_tables(float w) {
+	const float poly_note[3] = {69.0f, 69.0f, 69.0f};
+	for (int note = MYDSP_NOTE_MIN; (note <= MYDSP_NOTE_MAX); note = (note + 1)) {
+		for (int n = 0; (n < MODALBANK_MAX_MODES); n = (n + 1)) {
+			mydsp_cos_bar[(note - MYDSP_NOTE_MIN)][n] = mydsp_mode_cos_compute(w, 0.0f, n, float(note), poly_note);
+			mydsp_cos_int[(note - MYDSP_NOTE_MIN)][n] = mydsp_mode_cos_compute(w, 1.0f, n, float(note), poly_note);
+		}
+	}
+	for (int n = 0; (n < MODALBANK_MAX_MODES); n = (n + 1)) {
+		mydsp_cos_serge[n] = mydsp_mode_cos_compute(w, 2.0f, n, 69.0f, poly_note);
+	}
+}
+
+static inline bool mydsp_note_in_table(float note) {
+	return ((note >= float(MYDSP_NOTE_MIN)) && (note <= float(MYDSP_NOTE_MAX)) && (note == float(int(note))));
+}
+
+static float mydsp_mode_cos(float w, float route, int n, float note, const float* poly_note) {
+	if (route >= 3.0f) {
+		float key = poly_note[((n / 3) % 3)];
+		int k = ((n % 3) + (3 * (n / 9)));
+		if (mydsp_note_in_table(key) && (k < MODALBANK_MAX_MODES)) {
+			return mydsp_cos_int[(int(key) - MYDSP_NOTE_MIN)][k];
+		}
+	} else if (route >= 2.0f) {
+		return mydsp_cos_serge[n];
+	} else if (mydsp_note_in_table(note)) {
+		return ((route >= 1.0f) ? mydsp_cos_int : mydsp_cos_bar)[(int(note) - MYDSP_NOTE_MIN)][n];
+	}
+	return mydsp_mode_cos_compute(w, route, n, note, poly_note);
+}
+
+/*
+ Split channel mode: when a worker is set with mydsp::setWorker, compute
+ hands the whole block of the right channel to it and runs the left channel
+ itself, then waits for the worker before returning. See esp32worker (other
+ core of the ESP32) and threadworker (host thread) in the architecture part.
+*/
+class mydsp_worker {
 	
  public:
 	
-	FAUSTFLOAT fHslider0;
+	virtual ~mydsp_worker() {}
+	
+	// Start job(arg) on the worker and return immediately
+	virtual void post(void (*job)(void*), void* arg) = 0;
+	// Wait until the posted job has returned
+	virtual void wait() = 0;
+	
+};
+
+#if FIXED_POINT
+// One channel of the fixed-point engine, named after the float states
+// of the left channel. Signals and smoothers are Q24, the decay pole Q31.
+struct mydsp_q31_channel {
+	int32_t iRec2;
+	int32_t iRec3;
+	int iVec1;
+	int iRec6;
+	int32_t iRec7;
+	int iVec3;
+	int iRec8;
+	int32_t iDecayCoef;
+	int32_t iVec0;
+	int32_t iRec5;
+	int32_t iRec4;
+	int32_t iVec2;
+	int32_t iRec1;
+};
+#endif
+
+class mydsp : public dsp {
+	
+ public:
+	
+	FAUSTFLOAT fHslider0;
 	int fSampleRate;
 	float fConst0;
 	float fConst1;
@@ -10090,54 +11546,18 @@ class mydsp : public dsp {
 	FAUSTFLOAT fHslider7;
 	FAUSTFLOAT fHslider8;
 	FAUSTFLOAT fVslider0;
-	float fRec0[3];
 	float fConst11;
 	FAUSTFLOAT fButton2;
-	float fVec4[2];
-	float fRec9[2];
-	int iRec10[2];
 	FAUSTFLOAT fVslider1;
-	float fRec11[3];
 	FAUSTFLOAT fButton3;
-	float fVec5[2];
-	float fRec12[2];
-	int iRec13[2];
 	FAUSTFLOAT fVslider2;
-	float fRec14[3];
 	FAUSTFLOAT fButton4;
-	float fVec6[2];
-	float fRec15[2];
-	int iRec16[2];
-	float fRec17[3];
 	FAUSTFLOAT fButton5;
-	float fVec7[2];
-	float fRec18[2];
-	int iRec19[2];
-	float fRec20[3];
 	FAUSTFLOAT fButton6;
-	float fVec8[2];
-	float fRec21[2];
-	int iRec22[2];
-	float fRec23[3];
 	FAUSTFLOAT fButton7;
-	float fVec9[2];
-	float fRec24[2];
-	int iRec25[2];
-	float fRec26[3];
 	FAUSTFLOAT fButton8;
-	float fVec10[2];
-	float fRec27[2];
-	int iRec28[2];
-	float fRec29[3];
 	FAUSTFLOAT fButton9;
-	float fVec11[2];
-	float fRec30[2];
-	int iRec31[2];
-	float fRec32[3];
 	FAUSTFLOAT fButton10;
-	float fVec12[2];
-	float fRec33[2];
-	int iRec34[2];
 	float fVec13[2];
 	float fRec38[2];
 	float fRec37[2];
@@ -10153,56 +11573,67 @@ class mydsp : public dsp {
 	FAUSTFLOAT fHslider11;
 	FAUSTFLOAT fHslider12;
 	FAUSTFLOAT fVslider3;
-	float fRec35[3];
 	FAUSTFLOAT fButton12;
-	float fVec16[2];
-	float fRec41[2];
-	int iRec42[2];
-	float fRec43[3];
 	FAUSTFLOAT fButton13;
-	float fVec17[2];
-	float fRec44[2];
-	int iRec45[2];
-	float fRec46[3];
 	FAUSTFLOAT fButton14;
-	float fVec18[2];
-	float fRec47[2];
-	int iRec48[2];
 	FAUSTFLOAT fVslider4;
-	float fRec49[3];
 	FAUSTFLOAT fButton15;
-	float fVec19[2];
-	float fRec50[2];
-	int iRec51[2];
-	float fRec52[3];
 	FAUSTFLOAT fButton16;
-	float fVec20[2];
-	float fRec53[2];
-	int iRec54[2];
-	float fRec55[3];
 	FAUSTFLOAT fButton17;
-	float fVec21[2];
-	float fRec56[2];
-	int iRec57[2];
 	FAUSTFLOAT fVslider5;
-	float fRec58[3];
 	FAUSTFLOAT fButton18;
-	float fVec22[2];
-	float fRec59[2];
-	int iRec60[2];
-	float fRec61[3];
 	FAUSTFLOAT fButton19;
-	float fVec23[2];
-	float fRec62[2];
-	int iRec63[2];
-	float fRec64[3];
 	FAUSTFLOAT fButton20;
-	float fVec24[2];
-	float fRec65[2];
-	int iRec66[2];
+	float fDecayCoef0;
+	float fDecayCoef1;
+	modalbank fBank0;
+	modalbank fBank1;
+	float fModeKey0[5];
+	float fModeKey1[5];
+	float fZec0[BLOCK_PIPELINE_SIZE];
+	float fZec1[BLOCK_PIPELINE_SIZE];
+	float fZec2[BLOCK_PIPELINE_SIZE];
+	float fZec3[BLOCK_PIPELINE_SIZE];
+	float fZec4[BLOCK_PIPELINE_SIZE];
+	float fZec5[BLOCK_PIPELINE_SIZE];
+	float fZec6[BLOCK_PIPELINE_SIZE];
+	float fZec7[BLOCK_PIPELINE_SIZE];
+	float fZec8[BLOCK_PIPELINE_SIZE];
+	float fZec9[BLOCK_PIPELINE_SIZE];
+	float fZec10[BLOCK_PIPELINE_SIZE];
+	float fZec11[BLOCK_PIPELINE_SIZE];
+	float fZec12[BLOCK_PIPELINE_SIZE];
+	float fZec13[BLOCK_PIPELINE_SIZE];
+	float fZec14[BLOCK_PIPELINE_SIZE];
+	float fZec15[BLOCK_PIPELINE_SIZE];
+	float fRec41[2];
+	float fRec42[2];
+	float fVec16[2];
+	int iRec43[2];
+	float fControl[12];
+	mydsp_worker* fWorker;
+	int fSplitCount;
+	FAUSTFLOAT* fSplitInput;
+	FAUSTFLOAT* fSplitOutput;
+#if FIXED_POINT
+	q31modalbank fBankQ0;
+	q31modalbank fBankQ1;
+	mydsp_q31_channel fQ31[2];
+	int32_t iControl[12];
+	int32_t iConst2;
+	int32_t iConst3;
+	int32_t iConst4;
+	int32_t iConst5;
+	int32_t iConst6;
+	int32_t iConst7;
+	int32_t iConst8;
+#endif
+	
 	
  public:
 	
+	mydsp():fWorker(nullptr) {}
+	
 	void metadata(Meta* m) { 
 		m->declare("analyzers.lib/name", "Faust Analyzer Library");
 		m->declare("analyzers.lib/version", "0.1");
@@ -10312,6 +11743,7 @@ class mydsp : public dsp {
 	}
 	
 	static void classInit(int sample_rate) {
+		mydsp_fill_cos_tables((6.28318548f / std::min<float>(192000.0f, std::max<float>(1.0f, float(sample_rate)))));
 	}
 	
 	virtual void instanceConstants(int sample_rate) {
@@ -10328,6 +11760,25 @@ class mydsp : public dsp {
 		fConst9 = (1.0f / fConst0);
 		fConst10 = (6.28318548f / fConst0);
 		fConst11 = (1.0f / std::max<float>(1.0f, (0.25f * fConst0)));
+		fBank0.setNumModes(NHARMONICS);
+		fBank0.setMuteRate(fConst11);
+		fBank1.setNumModes(NHARMONICS);
+		fBank1.setMuteRate(fConst11);
+	#if FIXED_POINT
+		iConst2 = q31_from_float(fConst2);
+		iConst3 = q24_from_float(fConst3);
+		iConst4 = q31_from_float(fConst4);
+		iConst5 = q31_from_float(fConst5);
+		iConst6 = q24_from_float(fConst6);
+		iConst7 = q31_from_float(fConst7);
+		iConst8 = q31_from_float(fConst8);
+		fBankQ0.setNumModes(NHARMONICS);
+		fBankQ0.setMuteRate(fConst11);
+		fBankQ1.setNumModes(NHARMONICS);
+		fBankQ1.setMuteRate(fConst11);
+	#endif
+		fModeKey0[0] = -1.0f;
+		fModeKey1[0] = -1.0f;
 	}
 	
 	virtual void instanceResetUserInterface() {
@@ -10410,114 +11861,6 @@ class mydsp : public dsp {
 		for (int l11 = 0; (l11 < 2); l11 = (l11 + 1)) {
 			iRec8[l11] = 0;
 		}
-		for (int l12 = 0; (l12 < 3); l12 = (l12 + 1)) {
-			fRec0[l12] = 0.0f;
-		}
-		for (int l13 = 0; (l13 < 2); l13 = (l13 + 1)) {
-			fVec4[l13] = 0.0f;
-		}
-		for (int l14 = 0; (l14 < 2); l14 = (l14 + 1)) {
-			fRec9[l14] = 0.0f;
-		}
-		for (int l15 = 0; (l15 < 2); l15 = (l15 + 1)) {
-			iRec10[l15] = 0;
-		}
-		for (int l16 = 0; (l16 < 3); l16 = (l16 + 1)) {
-			fRec11[l16] = 0.0f;
-		}
-		for (int l17 = 0; (l17 < 2); l17 = (l17 + 1)) {
-			fVec5[l17] = 0.0f;
-		}
-		for (int l18 = 0; (l18 < 2); l18 = (l18 + 1)) {
-			fRec12[l18] = 0.0f;
-		}
-		for (int l19 = 0; (l19 < 2); l19 = (l19 + 1)) {
-			iRec13[l19] = 0;
-		}
-		for (int l20 = 0; (l20 < 3); l20 = (l20 + 1)) {
-			fRec14[l20] = 0.0f;
-		}
-		for (int l21 = 0; (l21 < 2); l21 = (l21 + 1)) {
-			fVec6[l21] = 0.0f;
-		}
-		for (int l22 = 0; (l22 < 2); l22 = (l22 + 1)) {
-			fRec15[l22] = 0.0f;
-		}
-		for (int l23 = 0; (l23 < 2); l23 = (l23 + 1)) {
-			iRec16[l23] = 0;
-		}
-		for (int l24 = 0; (l24 < 3); l24 = (l24 + 1)) {
-			fRec17[l24] = 0.0f;
-		}
-		for (int l25 = 0; (l25 < 2); l25 = (l25 + 1)) {
-			fVec7[l25] = 0.0f;
-		}
-		for (int l26 = 0; (l26 < 2); l26 = (l26 + 1)) {
-			fRec18[l26] = 0.0f;
-		}
-		for (int l27 = 0; (l27 < 2); l27 = (l27 + 1)) {
-			iRec19[l27] = 0;
-		}
-		for (int l28 = 0; (l28 < 3); l28 = (l28 + 1)) {
-			fRec20[l28] = 0.0f;
-		}
-		for (int l29 = 0; (l29 < 2); l29 = (l29 + 1)) {
-			fVec8[l29] = 0.0f;
-		}
-		for (int l30 = 0; (l30 < 2); l30 = (l30 + 1)) {
-			fRec21[l30] = 0.0f;
-		}
-		for (int l31 = 0; (l31 < 2); l31 = (l31 + 1)) {
-			iRec22[l31] = 0;
-		}
-		for (int l32 = 0; (l32 < 3); l32 = (l32 + 1)) {
-			fRec23[l32] = 0.0f;
-		}
-		for (int l33 = 0; (l33 < 2); l33 = (l33 + 1)) {
-			fVec9[l33] = 0.0f;
-		}
-		for (int l34 = 0; (l34 < 2); l34 = (l34 + 1)) {
-			fRec24[l34] = 0.0f;
-		}
-		for (int l35 = 0; (l35 < 2); l35 = (l35 + 1)) {
-			iRec25[l35] = 0;
-		}
-		for (int l36 = 0; (l36 < 3); l36 = (l36 + 1)) {
-			fRec26[l36] = 0.0f;
-		}
-		for (int l37 = 0; (l37 < 2); l37 = (l37 + 1)) {
-			fVec10[l37] = 0.0f;
-		}
-		for (int l38 = 0; (l38 < 2); l38 = (l38 + 1)) {
-			fRec27[l38] = 0.0f;
-		}
-		for (int l39 = 0; (l39 < 2); l39 = (l39 + 1)) {
-			iRec28[l39] = 0;
-		}
-		for (int l40 = 0; (l40 < 3); l40 = (l40 + 1)) {
-			fRec29[l40] = 0.0f;
-		}
-		for (int l41 = 0; (l41 < 2); l41 = (l41 + 1)) {
-			fVec11[l41] = 0.0f;
-		}
-		for (int l42 = 0; (l42 < 2); l42 = (l42 + 1)) {
-			fRec30[l42] = 0.0f;
-		}
-		for (int l43 = 0; (l43 < 2); l43 = (l43 + 1)) {
-			iRec31[l43] = 0;
-		}
-		for (int l44 = 0; (l44 < 3); l44 = (l44 + 1)) {
-			fRec32[l44] = 0.0f;
-		}
-		for (int l45 = 0; (l45 < 2); l45 = (l45 + 1)) {
-			fVec12[l45] = 0.0f;
-		}
-		for (int l46 = 0; (l46 < 2); l46 = (l46 + 1)) {
-			fRec33[l46] = 0.0f;
-		}
-		for (int l47 = 0; (l47 < 2); l47 = (l47 + 1)) {
-			iRec34[l47] = 0;
-		}
 		for (int l48 = 0; (l48 < 2); l48 = (l48 + 1)) {
 			fVec13[l48] = 0.0f;
 		}
@@ -10542,114 +11885,30 @@ class mydsp : public dsp {
 		for (int l55 = 0; (l55 < 2); l55 = (l55 + 1)) {
 			iRec40[l55] = 0;
 		}
-		for (int l56 = 0; (l56 < 3); l56 = (l56 + 1)) {
-			fRec35[l56] = 0.0f;
+		for (int l56 = 0; (l56 < 2); l56 = (l56 + 1)) {
+			fRec41[l56] = 0.0f;
 		}
 		for (int l57 = 0; (l57 < 2); l57 = (l57 + 1)) {
-			fVec16[l57] = 0.0f;
+			fRec42[l57] = 0.0f;
 		}
 		for (int l58 = 0; (l58 < 2); l58 = (l58 + 1)) {
-			fRec41[l58] = 0.0f;
+			fVec16[l58] = 0.0f;
 		}
 		for (int l59 = 0; (l59 < 2); l59 = (l59 + 1)) {
-			iRec42[l59] = 0;
-		}
-		for (int l60 = 0; (l60 < 3); l60 = (l60 + 1)) {
-			fRec43[l60] = 0.0f;
-		}
-		for (int l61 = 0; (l61 < 2); l61 = (l61 + 1)) {
-			fVec17[l61] = 0.0f;
-		}
-		for (int l62 = 0; (l62 < 2); l62 = (l62 + 1)) {
-			fRec44[l62] = 0.0f;
-		}
-		for (int l63 = 0; (l63 < 2); l63 = (l63 + 1)) {
-			iRec45[l63] = 0;
-		}
-		for (int l64 = 0; (l64 < 3); l64 = (l64 + 1)) {
-			fRec46[l64] = 0.0f;
-		}
-		for (int l65 = 0; (l65 < 2); l65 = (l65 + 1)) {
-			fVec18[l65] = 0.0f;
-		}
-		for (int l66 = 0; (l66 < 2); l66 = (l66 + 1)) {
-			fRec47[l66] = 0.0f;
-		}
-		for (int l67 = 0; (l67 < 2); l67 = (l67 + 1)) {
-			iRec48[l67] = 0;
-		}
-		for (int l68 = 0; (l68 < 3); l68 = (l68 + 1)) {
-			fRec49[l68] = 0.0f;
-		}
-		for (int l69 = 0; (l69 < 2); l69 = (l69 + 1)) {
-			fVec19[l69] = 0.0f;
-		}
-		for (int l70 = 0; (l70 < 2); l70 = (l70 + 1)) {
-			fRec50[l70] = 0.0f;
-		}
-		for (int l71 = 0; (l71 < 2); l71 = (l71 + 1)) {
-			iRec51[l71] = 0;
-		}
-		for (int l72 = 0; (l72 < 3); l72 = (l72 + 1)) {
-			fRec52[l72] = 0.0f;
-		}
-		for (int l73 = 0; (l73 < 2); l73 = (l73 + 1)) {
-			fVec20[l73] = 0.0f;
-		}
-		for (int l74 = 0; (l74 < 2); l74 = (l74 + 1)) {
-			fRec53[l74] = 0.0f;
-		}
-		for (int l75 = 0; (l75 < 2); l75 = (l75 + 1)) {
-			iRec54[l75] = 0;
-		}
-		for (int l76 = 0; (l76 < 3); l76 = (l76 + 1)) {
-			fRec55[l76] = 0.0f;
+			iRec43[l59] = 0;
 		}
-		for (int l77 = 0; (l77 < 2); l77 = (l77 + 1)) {
-			fVec21[l77] = 0.0f;
-		}
-		for (int l78 = 0; (l78 < 2); l78 = (l78 + 1)) {
-			fRec56[l78] = 0.0f;
-		}
-		for (int l79 = 0; (l79 < 2); l79 = (l79 + 1)) {
-			iRec57[l79] = 0;
-		}
-		for (int l80 = 0; (l80 < 3); l80 = (l80 + 1)) {
-			fRec58[l80] = 0.0f;
-		}
-		for (int l81 = 0; (l81 < 2); l81 = (l81 + 1)) {
-			fVec22[l81] = 0.0f;
-		}
-		for (int l82 = 0; (l82 < 2); l82 = (l82 + 1)) {
-			fRec59[l82] = 0.0f;
-		}
-		for (int l83 = 0; (l83 < 2); l83 = (l83 + 1)) {
-			iRec60[l83] = 0;
-		}
-		for (int l84 = 0; (l84 < 3); l84 = (l84 + 1)) {
-			fRec61[l84] = 0.0f;
-		}
-		for (int l85 = 0; (l85 < 2); l85 = (l85 + 1)) {
-			fVec23[l85] = 0.0f;
-		}
-		for (int l86 = 0; (l86 < 2); l86 = (l86 + 1)) {
-			fRec62[l86] = 0.0f;
-		}
-		for (int l87 = 0; (l87 < 2); l87 = (l87 + 1)) {
-			iRec63[l87] = 0;
-		}
-		for (int l88 = 0; (l88 < 3); l88 = (l88 + 1)) {
-			fRec64[l88] = 0.0f;
-		}
-		for (int l89 = 0; (l89 < 2); l89 = (l89 + 1)) {
-			fVec24[l89] = 0.0f;
-		}
-		for (int l90 = 0; (l90 < 2); l90 = (l90 + 1)) {
-			fRec65[l90] = 0.0f;
-		}
-		for (int l91 = 0; (l91 < 2); l91 = (l91 + 1)) {
-			iRec66[l91] = 0;
+		fDecayCoef0 = mydsp_decay_pole(fConst9, 0.0f);
+		fDecayCoef1 = mydsp_decay_pole(fConst9, 0.0f);
+		fBank0.clear();
+		fBank1.clear();
+	#if FIXED_POINT
+		for (int c = 0; (c < 2); c = (c + 1)) {
+			fQ31[c] = mydsp_q31_channel();
+			fQ31[c].iDecayCoef = q31_from_float(fDecayCoef0);
 		}
+		fBankQ0.clear();
+		fBankQ1.clear();
+	#endif
 	}
 	
 	virtual void init(int sample_rate) {
@@ -10666,6 +11925,49 @@ class mydsp : public dsp {
 		return new mydsp();
 	}
 	
+	/* The banks need 32 byte alignment, which the global operator new only gives from C++17 on */
+	static void* operator new(size_t size) {
+		return arena_aligned_alloc(size);
+	}
+	static void operator delete(void* ptr) {
+		arena_aligned_free(ptr);
+	}
+	static void* operator new(size_t, void* ptr) {
+		return ptr;
+	}
+	static void operator delete(void*, void*) {}
+	
+	/* An instance in the memory of 'manager' (aligned as the class), to be destroyed with the same manager */
+	static mydsp* create(dsp_memory_manager* manager) {
+		return new (manager->allocate(sizeof(mydsp))) mydsp();
+	}
+	static void destroy(mydsp* dsp, dsp_memory_manager* manager) {
+		dsp->~mydsp();
+		manager->destroy(dsp);
+	}
+	
+	/* Number of resonator modes of each side (1 to MODALBANK_MAX_MODES), to be changed between two blocks */
+	void setNumModes(int left, int right) {
+		fBank0.setNumModes(std::max<int>(1, left));
+		fBank1.setNumModes(std::max<int>(1, right));
+	#if FIXED_POINT
+		fBankQ0.setNumModes(std::max<int>(1, left));
+		fBankQ1.setNumModes(std::max<int>(1, right));
+	#endif
+		fModeKey0[0] = -1.0f;
+		fModeKey1[0] = -1.0f;
+	}
+	int getNumModes(int side) {
+		return ((side == 0) ? fBank0.getNumModes() : fBank1.getNumModes());
+	}
+	
+	/* Run the right channel on 'worker' (nullptr to run both channels in compute), to be changed between two blocks */
+	void setWorker(mydsp_worker* worker) {
+	#if BLOCK_PIPELINE
+		fWorker = worker;
+	#endif
+	}
+	
 	virtual int getSampleRate() {
 		return fSampleRate;
 	}
@@ -10721,11 +12023,225 @@ class mydsp : public dsp {
 		ui_interface->closeBox();
 	}
 	
-	virtual void compute(int count, FAUSTFLOAT** inputs, FAUSTFLOAT** outputs) {
-		FAUSTFLOAT* input0 = inputs[0];
-		FAUSTFLOAT* input1 = inputs[1];
-		FAUSTFLOAT* output0 = outputs[0];
-		FAUSTFLOAT* output1 = outputs[1];
+#if BLOCK_PIPELINE
+	// Block pipeline stages (see BLOCK_PIPELINE), one slice of at most
+	// BLOCK_PIPELINE_SIZE frames at a time. The stages of the two channels only
+	// share the control values in fControl, so that the right channel can run
+	// on another core (see setWorker). Each channel has its own copy of the
+	// gain smoothers and mode_changed envelope: fRec2, fRec3, fVec1 and iRec6
+	// for the left one, fRec41, fRec42, fVec16 and iRec43 for the right one.
+	
+	// Decay stage: pole coefficients of the bank, evaluated once per
+	// DECAY_SUBBLOCK and ramped linearly across it.
+	void computeDecay0(int vsize) {
+		float fRec7z = fRec7[1];
+		float fVec3z = fVec3[1];
+		int iRec8z = iRec8[1];
+		for (int i0 = 0; (i0 < vsize); i0 = (i0 + DECAY_SUBBLOCK)) {
+			int iCount = std::min<int>(DECAY_SUBBLOCK, (vsize - i0));
+			for (int j = 0; (j < iCount); j = (j + 1)) {
+				float fRec7n = (fControl[7] + (0.999000013f * fRec7z));
+				float fVec3n = fControl[8];
+				int iRec8n = (((iRec8z + (iRec8z > 0)) * (fControl[8] <= fVec3z)) + (fControl[8] > fVec3z));
+				fRec7z = fRec7n;
+				fVec3z = fVec3n;
+				iRec8z = iRec8n;
+			}
+			float fTemp7 = float(iRec8z);
+			float fDecay0 = mydsp_decay_pole(fConst9, (fRec7z * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp7), ((fConst8 * (fConst6 - fTemp7)) + 1.0f))))));
+			float fDecayStep0 = ((fDecay0 - fDecayCoef0) / float(iCount));
+			for (int i = i0; (i < (i0 + iCount)); i = (i + 1)) {
+				float fTemp8 = (fDecayCoef0 + (fDecayStep0 * float((i - i0) + 1)));
+				fZec0[i] = (0.0f - (2.0f * fTemp8));
+				fZec1[i] = mydsp_faustpower2_f(fTemp8);
+			}
+			fDecayCoef0 = fDecay0;
+		}
+		fRec7[1] = fRec7z;
+		fVec3[1] = fVec3z;
+		iRec8[1] = iRec8z;
+	}
+	
+	void computeDecay1(int vsize) {
+		float fRec39z = fRec39[1];
+		float fVec15z = fVec15[1];
+		int iRec40z = iRec40[1];
+		for (int i0 = 0; (i0 < vsize); i0 = (i0 + DECAY_SUBBLOCK)) {
+			int iCount = std::min<int>(DECAY_SUBBLOCK, (vsize - i0));
+			for (int j = 0; (j < iCount); j = (j + 1)) {
+				float fRec39n = (fControl[10] + (0.999000013f * fRec39z));
+				float fVec15n = fControl[11];
+				int iRec40n = (((iRec40z + (iRec40z > 0)) * (fControl[11] <= fVec15z)) + (fControl[11] > fVec15z));
+				fRec39z = fRec39n;
+				fVec15z = fVec15n;
+				iRec40z = iRec40n;
+			}
+			float fTemp17 = float(iRec40z);
+			float fDecay1 = mydsp_decay_pole(fConst9, (fRec39z * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp17), ((fConst8 * (fConst6 - fTemp17)) + 1.0f))))));
+			float fDecayStep1 = ((fDecay1 - fDecayCoef1) / float(iCount));
+			for (int i = i0; (i < (i0 + iCount)); i = (i + 1)) {
+				float fTemp18 = (fDecayCoef1 + (fDecayStep1 * float((i - i0) + 1)));
+				fZec2[i] = (0.0f - (2.0f * fTemp18));
+				fZec3[i] = mydsp_faustpower2_f(fTemp18);
+			}
+			fDecayCoef1 = fDecay1;
+		}
+		fRec39[1] = fRec39z;
+		fVec15[1] = fVec15z;
+		iRec40[1] = iRec40z;
+	}
+	
+	// Shared stage: input and mix gain smoothers, mode_changed envelope
+	void computeShared0(int vsize) {
+		float fRec2z = fRec2[1];
+		float fRec3z = fRec3[1];
+		float fVec1z = fVec1[1];
+		int iRec6z = iRec6[1];
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			float fRec2n = (fControl[2] + (0.999000013f * fRec2z));
+			float fRec3n = (fControl[3] + (0.999000013f * fRec3z));
+			fZec4[i] = (fRec2n * fRec3n);
+			fZec5[i] = (fRec2n * (1.0f - fRec3n));
+			float fVec1n = fControl[6];
+			int iRec6n = ((fControl[6] > fVec1z) + ((fControl[6] <= fVec1z) * (iRec6z + (iRec6z > 0))));
+			float fTemp4 = float(iRec6n);
+			fZec6[i] = (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp4), ((fConst8 * (fConst6 - fTemp4)) + 1.0f))));
+			fRec2z = fRec2n;
+			fRec3z = fRec3n;
+			fVec1z = fVec1n;
+			iRec6z = iRec6n;
+		}
+		fRec2[1] = fRec2z;
+		fRec3[1] = fRec3z;
+		fVec1[1] = fVec1z;
+		iRec6[1] = iRec6z;
+	}
+	
+	void computeShared1(int vsize) {
+		float fRec41z = fRec41[1];
+		float fRec42z = fRec42[1];
+		float fVec16z = fVec16[1];
+		int iRec43z = iRec43[1];
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			float fRec41n = (fControl[2] + (0.999000013f * fRec41z));
+			float fRec42n = (fControl[3] + (0.999000013f * fRec42z));
+			fZec13[i] = (fRec41n * fRec42n);
+			fZec14[i] = (fRec41n * (1.0f - fRec42n));
+			float fVec16n = fControl[6];
+			int iRec43n = ((fControl[6] > fVec16z) + ((fControl[6] <= fVec16z) * (iRec43z + (iRec43z > 0))));
+			float fTemp4 = float(iRec43n);
+			fZec15[i] = (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp4), ((fConst8 * (fConst6 - fTemp4)) + 1.0f))));
+			fRec41z = fRec41n;
+			fRec42z = fRec42n;
+			fVec16z = fVec16n;
+			iRec43z = iRec43n;
+		}
+		fRec41[1] = fRec41z;
+		fRec42[1] = fRec42z;
+		fVec16[1] = fVec16z;
+		iRec43[1] = iRec43z;
+	}
+	
+	// Input, resonator and output stages of one channel, using the shared
+	// stage buffers 'gain' (input gain * mix), 'dry' (input gain * (1 - mix))
+	// and 'env' (mode_changed envelope)
+	void computeSlice0(int vsize, FAUSTFLOAT* input0, FAUSTFLOAT* output0, const float* gain, const float* dry, const float* env) {
+		float fVec0z = fVec0[1];
+		float fRec5z = fRec5[1];
+		float fRec4z = fRec4[1];
+		float fVec2z = fVec2[1];
+		float fRec1z = fRec1[1];
+		// Input stage: DC blocker, amplitude follower and lowpass
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			float fTemp1 = float(input0[i]);
+			float fVec0n = fTemp1;
+			float fRec5n = ((fTemp1 + (0.995000005f * fRec5z)) - fVec0z);
+			float fTemp2 = (fControl[4] * fRec5n);
+			fZec7[i] = fTemp2;
+			float fTemp3 = std::fabs(fTemp2);
+			float fRec4n = std::max<float>(fTemp3, ((fConst4 * fRec4z) + (fConst5 * fTemp3)));
+			fHbargraph0 = FAUSTFLOAT((fRec4n > fControl[5]));
+			float fTemp6 = (fControl[1] * ((gain[i] * fTemp2) * env[i]));
+			float fVec2n = fTemp6;
+			float fRec1n = (0.0f - (fConst2 * ((fConst3 * fRec1z) - (fTemp6 + fVec2z))));
+			fZec8[i] = fRec1n;
+			fVec0z = fVec0n;
+			fRec5z = fRec5n;
+			fRec4z = fRec4n;
+			fVec2z = fVec2n;
+			fRec1z = fRec1n;
+		}
+		fVec0[1] = fVec0z;
+		fRec5[1] = fRec5z;
+		fRec4[1] = fRec4z;
+		fVec2[1] = fVec2z;
+		fRec1[1] = fRec1z;
+		// Resonator stage
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			fZec11[i] = fBank0.tick(fZec8[i], fZec0[i], fZec1[i]);
+		}
+		// Output stage: dry/wet mix and cubic soft clipper, no recursion
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			float fTemp12 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fControl[0] * fZec11[i]) + ((dry[i] * fZec7[i]) * env[i])))));
+			output0[i] = FAUSTFLOAT((fTemp12 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp12)))));
+		}
+	}
+	
+	void computeSlice1(int vsize, FAUSTFLOAT* input1, FAUSTFLOAT* output1, const float* gain, const float* dry, const float* env) {
+		float fVec13z = fVec13[1];
+		float fRec38z = fRec38[1];
+		float fRec37z = fRec37[1];
+		float fVec14z = fVec14[1];
+		float fRec36z = fRec36[1];
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			float fTemp13 = float(input1[i]);
+			float fVec13n = fTemp13;
+			float fRec38n = ((fTemp13 + (0.995000005f * fRec38z)) - fVec13z);
+			float fTemp14 = (fControl[4] * fRec38n);
+			fZec9[i] = fTemp14;
+			float fTemp15 = std::fabs(fTemp14);
+			float fRec37n = std::max<float>(fTemp15, ((fConst4 * fRec37z) + (fConst5 * fTemp15)));
+			fHbargraph1 = FAUSTFLOAT((fRec37n > fControl[9]));
+			float fTemp16 = (fControl[1] * ((gain[i] * env[i]) * fTemp14));
+			float fVec14n = fTemp16;
+			float fRec36n = (0.0f - (fConst2 * ((fConst3 * fRec36z) - (fTemp16 + fVec14z))));
+			fZec10[i] = fRec36n;
+			fVec13z = fVec13n;
+			fRec38z = fRec38n;
+			fRec37z = fRec37n;
+			fVec14z = fVec14n;
+			fRec36z = fRec36n;
+		}
+		fVec13[1] = fVec13z;
+		fRec38[1] = fRec38z;
+		fRec37[1] = fRec37z;
+		fVec14[1] = fVec14z;
+		fRec36[1] = fRec36z;
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			fZec12[i] = fBank1.tick(fZec10[i], fZec2[i], fZec3[i]);
+		}
+		for (int i = 0; (i < vsize); i = (i + 1)) {
+			float fTemp21 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fControl[0] * fZec12[i]) + ((dry[i] * env[i]) * fZec9[i])))));
+			output1[i] = FAUSTFLOAT((fTemp21 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp21)))));
+		}
+	}
+	
+	// Whole block of the right channel, run by the worker in split mode
+	static void computeChannel1(void* arg) {
+		mydsp* self = static_cast<mydsp*>(arg);
+		for (int v0 = 0; (v0 < self->fSplitCount); v0 = (v0 + BLOCK_PIPELINE_SIZE)) {
+			int vsize = std::min<int>(BLOCK_PIPELINE_SIZE, (self->fSplitCount - v0));
+			self->computeDecay1(vsize);
+			self->computeShared1(vsize);
+			self->computeSlice1(vsize, &self->fSplitInput[v0], &self->fSplitOutput[v0], self->fZec13, self->fZec14, self->fZec15);
+		}
+	}
+	
+#endif
+	// Control rate section of compute: reads the parameters into fControl and
+	// updates the mode frequencies and mute buttons of the two banks
+	template <class BANK>
+	void control(BANK& bank0, BANK& bank1) {
 		float fSlow0 = mydsp_faustpower2_f(float(fHslider0));
 		float fSlow1 = mydsp_faustpower2_f(float(fHslider1));
 		float fSlow2 = (0.00100000005f * mydsp_faustpower2_f(float(fHslider2)));
@@ -10736,312 +12252,434 @@ class mydsp : public dsp {
 		float fSlow7 = (0.00100000005f * float(fHslider6));
 		float fSlow8 = float(fButton1);
 		float fSlow9 = float(fHslider7);
-		int iSlow10 = (fSlow9 >= 2.0f);
-		int iSlow11 = (fSlow9 >= 1.0f);
-		float fSlow12 = std::pow(2.0f, (0.0833333358f * (float(fHslider8) + -69.0f)));
-		int iSlow13 = (fSlow9 >= 3.0f);
-		float fSlow14 = std::pow(2.0f, (0.0833333358f * (float(fVslider0) + -69.0f)));
-		float fSlow15 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (440.0f * fSlow14) : 2800.0f) : (iSlow11 ? (3080.0f * fSlow12) : (10999.8896f * fSlow12))), 16000.0f)));
-		float fSlow16 = float(fButton2);
-		int iSlow17 = (fSlow16 == 0.0f);
-		float fSlow18 = std::pow(2.0f, (0.0833333358f * (float(fVslider1) + -69.0f)));
-		float fSlow19 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (1320.0f * fSlow18) : 1500.0f) : (iSlow11 ? (2640.0f * fSlow12) : (8262.13965f * fSlow12))), 16000.0f)));
-		float fSlow20 = float(fButton3);
-		int iSlow21 = (fSlow20 == 0.0f);
-		float fSlow22 = std::pow(2.0f, (0.0833333358f * (float(fVslider2) + -69.0f)));
-		float fSlow23 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (1320.0f * fSlow22) : 218.0f) : (iSlow11 ? (1320.0f * fSlow12) : (2395.53149f * fSlow12))), 16000.0f)));
-		float fSlow24 = float(fButton4);
-		int iSlow25 = (fSlow24 == 0.0f);
-		float fSlow26 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (880.0f * fSlow22) : 115.0f) : (iSlow11 ? (880.0f * fSlow12) : (1222.20996f * fSlow12))), 16000.0f)));
-		float fSlow27 = float(fButton5);
-		int iSlow28 = (fSlow27 == 0.0f);
-		float fSlow29 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (440.0f * fSlow22) : 62.0f) : (iSlow11 ? (440.0f * fSlow12) : (439.995605f * fSlow12))), 16000.0f)));
-		float fSlow30 = float(fButton6);
-		int iSlow31 = (fSlow30 == 0.0f);
-		float fSlow32 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (440.0f * fSlow18) : 411.0f) : (iSlow11 ? (1760.0f * fSlow12) : (3959.96045f * fSlow12))), 16000.0f)));
-		float fSlow33 = float(fButton7);
-		int iSlow34 = (fSlow33 == 0.0f);
-		float fSlow35 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (880.0f * fSlow18) : 777.0f) : (iSlow11 ? (2200.0f * fSlow12) : (5915.49658f * fSlow12))), 16000.0f)));
-		float fSlow36 = float(fButton8);
-		int iSlow37 = (fSlow36 == 0.0f);
-		float fSlow38 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (880.0f * fSlow14) : 5200.0f) : (iSlow11 ? (3520.0f * fSlow12) : (14128.748f * fSlow12))), 16000.0f)));
-		float fSlow39 = float(fButton9);
-		int iSlow40 = (fSlow39 == 0.0f);
-		float fSlow41 = std::cos((fConst10 * std::min<float>((iSlow10 ? (iSlow13 ? (1320.0f * fSlow14) : 11000.0f) : (iSlow11 ? (3960.0f * fSlow12) : (17648.7129f * fSlow12))), 16000.0f)));
-		float fSlow42 = float(fButton10);
-		int iSlow43 = (fSlow42 == 0.0f);
+		float fSlow10 = float(fHslider8);
+		float fSlow11[3] = {float(fVslider2), float(fVslider1), float(fVslider0)};
+		if ((fSlow9 != fModeKey0[0]) || (fSlow10 != fModeKey0[1]) || (fSlow11[0] != fModeKey0[2]) || (fSlow11[1] != fModeKey0[3]) || (fSlow11[2] != fModeKey0[4])) {
+			for (int n = 0; (n < bank0.getNumModes()); n = (n + 1)) {
+				bank0.setCos(n, mydsp_mode_cos(fConst10, fSlow9, n, fSlow10, fSlow11));
+			}
+			fModeKey0[0] = fSlow9;
+			fModeKey0[1] = fSlow10;
+			fModeKey0[2] = fSlow11[0];
+			fModeKey0[3] = fSlow11[1];
+			fModeKey0[4] = fSlow11[2];
+		}
+		bank0.setMute(0, float(fButton6));
+		bank0.setMute(1, float(fButton5));
+		bank0.setMute(2, float(fButton4));
+		bank0.setMute(3, float(fButton7));
+		bank0.setMute(4, float(fButton8));
+		bank0.setMute(5, float(fButton3));
+		bank0.setMute(6, float(fButton2));
+		bank0.setMute(7, float(fButton9));
+		bank0.setMute(8, float(fButton10));
 		float fSlow44 = float(fHslider9);
 		float fSlow45 = (0.00100000005f * float(fHslider10));
 		float fSlow46 = float(fButton11);
 		float fSlow47 = float(fHslider11);
-		int iSlow48 = (fSlow47 >= 2.0f);
-		int iSlow49 = (fSlow47 >= 1.0f);
-		float fSlow50 = std::pow(2.0f, (0.0833333358f * (float(fHslider12) + -69.0f)));
-		int iSlow51 = (fSlow47 >= 3.0f);
-		float fSlow52 = std::pow(2.0f, (0.0833333358f * (float(fVslider3) + -69.0f)));
-		float fSlow53 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (1320.0f * fSlow52) : 1500.0f) : (iSlow49 ? (2640.0f * fSlow50) : (8262.13965f * fSlow50))), 16000.0f)));
-		float fSlow54 = float(fButton12);
-		int iSlow55 = (fSlow54 == 0.0f);
-		float fSlow56 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (880.0f * fSlow52) : 777.0f) : (iSlow49 ? (2200.0f * fSlow50) : (5915.49658f * fSlow50))), 16000.0f)));
-		float fSlow57 = float(fButton13);
-		int iSlow58 = (fSlow57 == 0.0f);
-		float fSlow59 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (440.0f * fSlow52) : 411.0f) : (iSlow49 ? (1760.0f * fSlow50) : (3959.96045f * fSlow50))), 16000.0f)));
-		float fSlow60 = float(fButton14);
-		int iSlow61 = (fSlow60 == 0.0f);
-		float fSlow62 = std::pow(2.0f, (0.0833333358f * (float(fVslider4) + -69.0f)));
-		float fSlow63 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (1320.0f * fSlow62) : 218.0f) : (iSlow49 ? (1320.0f * fSlow50) : (2395.53149f * fSlow50))), 16000.0f)));
-		float fSlow64 = float(fButton15);
-		int iSlow65 = (fSlow64 == 0.0f);
-		float fSlow66 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (880.0f * fSlow62) : 115.0f) : (iSlow49 ? (880.0f * fSlow50) : (1222.20996f * fSlow50))), 16000.0f)));
-		float fSlow67 = float(fButton16);
-		int iSlow68 = (fSlow67 == 0.0f);
-		float fSlow69 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (440.0f * fSlow62) : 62.0f) : (iSlow49 ? (440.0f * fSlow50) : (439.995605f * fSlow50))), 16000.0f)));
-		float fSlow70 = float(fButton17);
-		int iSlow71 = (fSlow70 == 0.0f);
-		float fSlow72 = std::pow(2.0f, (0.0833333358f * (float(fVslider5) + -69.0f)));
-		float fSlow73 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (440.0f * fSlow72) : 2800.0f) : (iSlow49 ? (3080.0f * fSlow50) : (10999.8896f * fSlow50))), 16000.0f)));
-		float fSlow74 = float(fButton18);
-		int iSlow75 = (fSlow74 == 0.0f);
-		float fSlow76 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (880.0f * fSlow72) : 5200.0f) : (iSlow49 ? (3520.0f * fSlow50) : (14128.748f * fSlow50))), 16000.0f)));
-		float fSlow77 = float(fButton19);
-		int iSlow78 = (fSlow77 == 0.0f);
-		float fSlow79 = std::cos((fConst10 * std::min<float>((iSlow48 ? (iSlow51 ? (1320.0f * fSlow72) : 11000.0f) : (iSlow49 ? (3960.0f * fSlow50) : (17648.7129f * fSlow50))), 16000.0f)));
-		float fSlow80 = float(fButton20);
-		int iSlow81 = (fSlow80 == 0.0f);
-		for (int i = 0; (i < count); i = (i + 1)) {
-			fRec2[0] = (fSlow2 + (0.999000013f * fRec2[1]));
-			fRec3[0] = (fSlow3 + (0.999000013f * fRec3[1]));
-			float fTemp0 = (fRec2[0] * fRec3[0]);
-			float fTemp1 = float(input0[i]);
-			fVec0[0] = fTemp1;
-			fRec5[0] = ((fTemp1 + (0.995000005f * fRec5[1])) - fVec0[1]);
-			float fTemp2 = (fSlow4 * fRec5[0]);
-			float fTemp3 = std::fabs(fTemp2);
-			fRec4[0] = std::max<float>(fTemp3, ((fConst4 * fRec4[1]) + (fConst5 * fTemp3)));
-			fHbargraph0 = FAUSTFLOAT((fRec4[0] > fSlow5));
-			fVec1[0] = fSlow6;
-			iRec6[0] = ((fSlow6 > fVec1[1]) + ((fSlow6 <= fVec1[1]) * (iRec6[1] + (iRec6[1] > 0))));
-			float fTemp4 = float(iRec6[0]);
-			float fTemp5 = (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp4), ((fConst8 * (fConst6 - fTemp4)) + 1.0f))));
-			float fTemp6 = (fSlow1 * ((fTemp0 * fTemp2) * fTemp5));
-			fVec2[0] = fTemp6;
-			fRec1[0] = (0.0f - (fConst2 * ((fConst3 * fRec1[1]) - (fTemp6 + fVec2[1]))));
-			fRec7[0] = (fSlow7 + (0.999000013f * fRec7[1]));
-			fVec3[0] = fSlow8;
-			iRec8[0] = (((iRec8[1] + (iRec8[1] > 0)) * (fSlow8 <= fVec3[1])) + (fSlow8 > fVec3[1]));
+		float fSlow48 = float(fHslider12);
+		float fSlow49[3] = {float(fVslider4), float(fVslider3), float(fVslider5)};
+		if ((fSlow47 != fModeKey1[0]) || (fSlow48 != fModeKey1[1]) || (fSlow49[0] != fModeKey1[2]) || (fSlow49[1] != fModeKey1[3]) || (fSlow49[2] != fModeKey1[4])) {
+			for (int n = 0; (n < bank1.getNumModes()); n = (n + 1)) {
+				bank1.setCos(n, mydsp_mode_cos(fConst10, fSlow47, n, fSlow48, fSlow49));
+			}
+			fModeKey1[0] = fSlow47;
+			fModeKey1[1] = fSlow48;
+			fModeKey1[2] = fSlow49[0];
+			fModeKey1[3] = fSlow49[1];
+			fModeKey1[4] = fSlow49[2];
+		}
+		bank1.setMute(0, float(fButton17));
+		bank1.setMute(1, float(fButton16));
+		bank1.setMute(2, float(fButton15));
+		bank1.setMute(3, float(fButton14));
+		bank1.setMute(4, float(fButton13));
+		bank1.setMute(5, float(fButton12));
+		bank1.setMute(6, float(fButton18));
+		bank1.setMute(7, float(fButton19));
+		bank1.setMute(8, float(fButton20));
+		fControl[0] = fSlow0;
+		fControl[1] = fSlow1;
+		fControl[2] = fSlow2;
+		fControl[3] = fSlow3;
+		fControl[4] = fSlow4;
+		fControl[5] = fSlow5;
+		fControl[6] = fSlow6;
+		fControl[7] = fSlow7;
+		fControl[8] = fSlow8;
+		fControl[9] = fSlow44;
+		fControl[10] = fSlow45;
+		fControl[11] = fSlow46;
+	}
+	
+	virtual void compute(int count, FAUSTFLOAT** inputs, FAUSTFLOAT** outputs) {
+		FAUSTFLOAT* input0 = inputs[0];
+		FAUSTFLOAT* input1 = inputs[1];
+		FAUSTFLOAT* output0 = outputs[0];
+		FAUSTFLOAT* output1 = outputs[1];
+		control(fBank0, fBank1);
+#if BLOCK_PIPELINE
+		if (fWorker) {
+			fSplitCount = count;
+			fSplitInput = input1;
+			fSplitOutput = output1;
+			fWorker->post(computeChannel1, this);
+			for (int v0 = 0; (v0 < count); v0 = (v0 + BLOCK_PIPELINE_SIZE)) {
+				int vsize = std::min<int>(BLOCK_PIPELINE_SIZE, (count - v0));
+				computeDecay0(vsize);
+				computeShared0(vsize);
+				computeSlice0(vsize, &input0[v0], &output0[v0], fZec4, fZec5, fZec6);
+			}
+			fWorker->wait();
+		} else {
+			for (int v0 = 0; (v0 < count); v0 = (v0 + BLOCK_PIPELINE_SIZE)) {
+				int vsize = std::min<int>(BLOCK_PIPELINE_SIZE, (count - v0));
+				computeDecay0(vsize);
+				computeDecay1(vsize);
+				computeShared0(vsize);
+				computeSlice0(vsize, &input0[v0], &output0[v0], fZec4, fZec5, fZec6);
+				computeSlice1(vsize, &input1[v0], &output1[v0], fZec4, fZec5, fZec6);
+			}
+			// Keep the right channel copy of the shared stage in step, for the split mode
+			fRec41[1] = fRec2[1];
+			fRec42[1] = fRec3[1];
+			fVec16[1] = fVec1[1];
+			iRec43[1] = iRec6[1];
+		}
+#else
+		float fSlow0 = fControl[0];
+		float fSlow1 = fControl[1];
+		float fSlow2 = fControl[2];
+		float fSlow3 = fControl[3];
+		float fSlow4 = fControl[4];
+		float fSlow5 = fControl[5];
+		float fSlow6 = fControl[6];
+		float fSlow7 = fControl[7];
+		float fSlow8 = fControl[8];
+		float fSlow44 = fControl[9];
+		float fSlow45 = fControl[10];
+		float fSlow46 = fControl[11];
+#if RING_STATE
+		// Ring state layout: the one sample histories are kept in locals (registers)
+		// for the whole block and written back once at the end, instead of being
+		// shifted in memory every sample. Bit-exact with the shifted layout below.
+		float fRec7z = fRec7[1];
+		float fVec3z = fVec3[1];
+		int iRec8z = iRec8[1];
+		float fRec39z = fRec39[1];
+		float fVec15z = fVec15[1];
+		int iRec40z = iRec40[1];
+		float fRec2z = fRec2[1];
+		float fRec3z = fRec3[1];
+		float fVec0z = fVec0[1];
+		float fRec5z = fRec5[1];
+		float fRec4z = fRec4[1];
+		float fVec1z = fVec1[1];
+		int iRec6z = iRec6[1];
+		float fVec2z = fVec2[1];
+		float fRec1z = fRec1[1];
+		float fVec13z = fVec13[1];
+		float fRec38z = fRec38[1];
+		float fRec37z = fRec37[1];
+		float fVec14z = fVec14[1];
+		float fRec36z = fRec36[1];
+		for (int i0 = 0; (i0 < count); i0 = (i0 + DECAY_SUBBLOCK)) {
+			int iCount = std::min<int>(DECAY_SUBBLOCK, (count - i0));
+			// Control rate decay: run the cheap decay smoothers and mode_changed
+			// envelopes to the end of the sub-block, evaluate the T60 pole radius
+			// once there and ramp it linearly across the sub-block.
+			for (int j = 0; (j < iCount); j = (j + 1)) {
+				float fRec7n = (fSlow7 + (0.999000013f * fRec7z));
+				float fVec3n = fSlow8;
+				int iRec8n = (((iRec8z + (iRec8z > 0)) * (fSlow8 <= fVec3z)) + (fSlow8 > fVec3z));
+				float fRec39n = (fSlow45 + (0.999000013f * fRec39z));
+				float fVec15n = fSlow46;
+				int iRec40n = (((iRec40z + (iRec40z > 0)) * (fSlow46 <= fVec15z)) + (fSlow46 > fVec15z));
+				fRec7z = fRec7n;
+				fVec3z = fVec3n;
+				iRec8z = iRec8n;
+				fRec39z = fRec39n;
+				fVec15z = fVec15n;
+				iRec40z = iRec40n;
+			}
+			float fTemp7 = float(iRec8z);
+			float fDecay0 = mydsp_decay_pole(fConst9, (fRec7z * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp7), ((fConst8 * (fConst6 - fTemp7)) + 1.0f))))));
+			float fDecayStep0 = ((fDecay0 - fDecayCoef0) / float(iCount));
+			float fTemp17 = float(iRec40z);
+			float fDecay1 = mydsp_decay_pole(fConst9, (fRec39z * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp17), ((fConst8 * (fConst6 - fTemp17)) + 1.0f))))));
+			float fDecayStep1 = ((fDecay1 - fDecayCoef1) / float(iCount));
+			for (int i = i0; (i < (i0 + iCount)); i = (i + 1)) {
+				float fRec2n = (fSlow2 + (0.999000013f * fRec2z));
+				float fRec3n = (fSlow3 + (0.999000013f * fRec3z));
+				float fTemp0 = (fRec2n * fRec3n);
+				float fTemp1 = float(input0[i]);
+				float fVec0n = fTemp1;
+				float fRec5n = ((fTemp1 + (0.995000005f * fRec5z)) - fVec0z);
+				float fTemp2 = (fSlow4 * fRec5n);
+				float fTemp3 = std::fabs(fTemp2);
+				float fRec4n = std::max<float>(fTemp3, ((fConst4 * fRec4z) + (fConst5 * fTemp3)));
+				fHbargraph0 = FAUSTFLOAT((fRec4n > fSlow5));
+				float fVec1n = fSlow6;
+				int iRec6n = ((fSlow6 > fVec1z) + ((fSlow6 <= fVec1z) * (iRec6z + (iRec6z > 0))));
+				float fTemp4 = float(iRec6n);
+				float fTemp5 = (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp4), ((fConst8 * (fConst6 - fTemp4)) + 1.0f))));
+				float fTemp6 = (fSlow1 * ((fTemp0 * fTemp2) * fTemp5));
+				float fVec2n = fTemp6;
+				float fRec1n = (0.0f - (fConst2 * ((fConst3 * fRec1z) - (fTemp6 + fVec2z))));
+				float fTemp8 = (fDecayCoef0 + (fDecayStep0 * float((i - i0) + 1)));
+				float fTemp9 = (0.0f - (2.0f * fTemp8));
+				float fTemp10 = mydsp_faustpower2_f(fTemp8);
+				float fTemp11 = (fRec2n * (1.0f - fRec3n));
+				float fTemp12 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fSlow0 * fBank0.tick(fRec1n, fTemp9, fTemp10)) + ((fTemp11 * fTemp2) * fTemp5)))));
+				output0[i] = FAUSTFLOAT((fTemp12 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp12)))));
+				float fTemp13 = float(input1[i]);
+				float fVec13n = fTemp13;
+				float fRec38n = ((fTemp13 + (0.995000005f * fRec38z)) - fVec13z);
+				float fTemp14 = (fSlow4 * fRec38n);
+				float fTemp15 = std::fabs(fTemp14);
+				float fRec37n = std::max<float>(fTemp15, ((fConst4 * fRec37z) + (fConst5 * fTemp15)));
+				fHbargraph1 = FAUSTFLOAT((fRec37n > fSlow44));
+				float fTemp16 = (fSlow1 * ((fTemp0 * fTemp5) * fTemp14));
+				float fVec14n = fTemp16;
+				float fRec36n = (0.0f - (fConst2 * ((fConst3 * fRec36z) - (fTemp16 + fVec14z))));
+				float fTemp18 = (fDecayCoef1 + (fDecayStep1 * float((i - i0) + 1)));
+				float fTemp19 = (0.0f - (2.0f * fTemp18));
+				float fTemp20 = mydsp_faustpower2_f(fTemp18);
+				float fTemp21 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fSlow0 * fBank1.tick(fRec36n, fTemp19, fTemp20)) + ((fTemp11 * fTemp5) * fTemp14)))));
+				output1[i] = FAUSTFLOAT((fTemp21 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp21)))));
+				fRec2z = fRec2n;
+				fRec3z = fRec3n;
+				fVec0z = fVec0n;
+				fRec5z = fRec5n;
+				fRec4z = fRec4n;
+				fVec1z = fVec1n;
+				iRec6z = iRec6n;
+				fVec2z = fVec2n;
+				fRec1z = fRec1n;
+				fVec13z = fVec13n;
+				fRec38z = fRec38n;
+				fRec37z = fRec37n;
+				fVec14z = fVec14n;
+				fRec36z = fRec36n;
+			}
+			fDecayCoef0 = fDecay0;
+			fDecayCoef1 = fDecay1;
+		}
+		fRec7[1] = fRec7z;
+		fVec3[1] = fVec3z;
+		iRec8[1] = iRec8z;
+		fRec39[1] = fRec39z;
+		fVec15[1] = fVec15z;
+		iRec40[1] = iRec40z;
+		fRec2[1] = fRec2z;
+		fRec3[1] = fRec3z;
+		fVec0[1] = fVec0z;
+		fRec5[1] = fRec5z;
+		fRec4[1] = fRec4z;
+		fVec1[1] = fVec1z;
+		iRec6[1] = iRec6z;
+		fVec2[1] = fVec2z;
+		fRec1[1] = fRec1z;
+		fVec13[1] = fVec13z;
+		fRec38[1] = fRec38z;
+		fRec37[1] = fRec37z;
+		fVec14[1] = fVec14z;
+		fRec36[1] = fRec36z;
+#else
+		for (int i0 = 0; (i0 < count); i0 = (i0 + DECAY_SUBBLOCK)) {
+			int iCount = std::min<int>(DECAY_SUBBLOCK, (count - i0));
+			// Control rate decay: run the cheap decay smoothers and mode_changed
+			// envelopes to the end of the sub-block, evaluate the T60 pole radius
+			// once there and ramp it linearly across the sub-block.
+			for (int j = 0; (j < iCount); j = (j + 1)) {
+				fRec7[0] = (fSlow7 + (0.999000013f * fRec7[1]));
+				fVec3[0] = fSlow8;
+				iRec8[0] = (((iRec8[1] + (iRec8[1] > 0)) * (fSlow8 <= fVec3[1])) + (fSlow8 > fVec3[1]));
+				fRec39[0] = (fSlow45 + (0.999000013f * fRec39[1]));
+				fVec15[0] = fSlow46;
+				iRec40[0] = (((iRec40[1] + (iRec40[1] > 0)) * (fSlow46 <= fVec15[1])) + (fSlow46 > fVec15[1]));
+				fRec7[1] = fRec7[0];
+				fVec3[1] = fVec3[0];
+				iRec8[1] = iRec8[0];
+				fRec39[1] = fRec39[0];
+				fVec15[1] = fVec15[0];
+				iRec40[1] = iRec40[0];
+			}
 			float fTemp7 = float(iRec8[0]);
-			float fTemp8 = std::pow(0.00100000005f, (fConst9 / ((fRec7[0] * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp7), ((fConst8 * (fConst6 - fTemp7)) + 1.0f))))) + 0.0500000007f)));
-			float fTemp9 = (0.0f - (2.0f * fTemp8));
-			float fTemp10 = mydsp_faustpower2_f(fTemp8);
-			fRec0[0] = (fRec1[0] - (((fTemp9 * fRec0[1]) * fSlow15) + (fTemp10 * fRec0[2])));
-			fVec4[0] = fSlow16;
-			fRec9[0] = (fSlow16 + (fRec9[1] * float((fVec4[1] >= fSlow16))));
-			iRec10[0] = (iSlow17 * (iRec10[1] + 1));
-			fRec11[0] = (fRec1[0] - (((fTemp9 * fRec11[1]) * fSlow19) + (fTemp10 * fRec11[2])));
-			fVec5[0] = fSlow20;
-			fRec12[0] = (fSlow20 + (fRec12[1] * float((fVec5[1] >= fSlow20))));
-			iRec13[0] = (iSlow21 * (iRec13[1] + 1));
-			fRec14[0] = (fRec1[0] - (((fTemp9 * fRec14[1]) * fSlow23) + (fTemp10 * fRec14[2])));
-			fVec6[0] = fSlow24;
-			fRec15[0] = (fSlow24 + (fRec15[1] * float((fVec6[1] >= fSlow24))));
-			iRec16[0] = (iSlow25 * (iRec16[1] + 1));
-			fRec17[0] = (fRec1[0] - (((fTemp9 * fRec17[1]) * fSlow26) + (fTemp10 * fRec17[2])));
-			fVec7[0] = fSlow27;
-			fRec18[0] = (fSlow27 + (fRec18[1] * float((fVec7[1] >= fSlow27))));
-			iRec19[0] = (iSlow28 * (iRec19[1] + 1));
-			fRec20[0] = (fRec1[0] - (((fRec20[1] * fTemp9) * fSlow29) + (fTemp10 * fRec20[2])));
-			fVec8[0] = fSlow30;
-			fRec21[0] = (fSlow30 + (fRec21[1] * float((fVec8[1] >= fSlow30))));
-			iRec22[0] = (iSlow31 * (iRec22[1] + 1));
-			fRec23[0] = (fRec1[0] - (((fTemp9 * fRec23[1]) * fSlow32) + (fTemp10 * fRec23[2])));
-			fVec9[0] = fSlow33;
-			fRec24[0] = (fSlow33 + (fRec24[1] * float((fVec9[1] >= fSlow33))));
-			iRec25[0] = (iSlow34 * (iRec25[1] + 1));
-			fRec26[0] = (fRec1[0] - (((fTemp9 * fRec26[1]) * fSlow35) + (fTemp10 * fRec26[2])));
-			fVec10[0] = fSlow36;
-			fRec27[0] = (fSlow36 + (fRec27[1] * float((fVec10[1] >= fSlow36))));
-			iRec28[0] = (iSlow37 * (iRec28[1] + 1));
-			fRec29[0] = (fRec1[0] - (((fTemp9 * fRec29[1]) * fSlow38) + (fTemp10 * fRec29[2])));
-			fVec11[0] = fSlow39;
-			fRec30[0] = (fSlow39 + (fRec30[1] * float((fVec11[1] >= fSlow39))));
-			iRec31[0] = (iSlow40 * (iRec31[1] + 1));
-			fRec32[0] = (fRec1[0] - (((fTemp9 * fRec32[1]) * fSlow41) + (fTemp10 * fRec32[2])));
-			fVec12[0] = fSlow42;
-			fRec33[0] = (fSlow42 + (fRec33[1] * float((fVec12[1] >= fSlow42))));
-			iRec34[0] = (iSlow43 * (iRec34[1] + 1));
-			float fTemp11 = (fRec2[0] * (1.0f - fRec3[0]));
-			float fTemp12 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fSlow0 * (((fRec0[0] - fRec0[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec9[0]), 1.0f) - (fConst11 * float(iRec10[0]))))))) + (((fRec11[0] - fRec11[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec12[0]), 1.0f) - (fConst11 * float(iRec13[0]))))))) + (((fRec14[0] - fRec14[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec15[0]), 1.0f) - (fConst11 * float(iRec16[0]))))))) + (((fRec17[0] - fRec17[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec18[0]), 1.0f) - (fConst11 * float(iRec19[0]))))))) + (((fRec20[0] - fRec20[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec21[0]), 1.0f) - (fConst11 * float(iRec22[0]))))))) + (((fRec23[0] - fRec23[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec24[0]), 1.0f) - (fConst11 * float(iRec25[0]))))))) + ((((fRec26[0] - fRec26[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec27[0]), 1.0f) - (fConst11 * float(iRec28[0]))))))) + ((fRec29[0] - fRec29[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec30[0]), 1.0f) - (fConst11 * float(iRec31[0])))))))) + ((fRec32[0] - fRec32[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec33[0]), 1.0f) - (fConst11 * float(iRec34[0]))))))))))))))) + ((fTemp11 * fTemp2) * fTemp5)))));
-			output0[i] = FAUSTFLOAT((fTemp12 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp12)))));
-			float fTemp13 = float(input1[i]);
-			fVec13[0] = fTemp13;
-			fRec38[0] = ((fTemp13 + (0.995000005f * fRec38[1])) - fVec13[1]);
-			float fTemp14 = (fSlow4 * fRec38[0]);
-			float fTemp15 = std::fabs(fTemp14);
-			fRec37[0] = std::max<float>(fTemp15, ((fConst4 * fRec37[1]) + (fConst5 * fTemp15)));
-			fHbargraph1 = FAUSTFLOAT((fRec37[0] > fSlow44));
-			float fTemp16 = (fSlow1 * ((fTemp0 * fTemp5) * fTemp14));
-			fVec14[0] = fTemp16;
-			fRec36[0] = (0.0f - (fConst2 * ((fConst3 * fRec36[1]) - (fTemp16 + fVec14[1]))));
-			fRec39[0] = (fSlow45 + (0.999000013f * fRec39[1]));
-			fVec15[0] = fSlow46;
-			iRec40[0] = (((iRec40[1] + (iRec40[1] > 0)) * (fSlow46 <= fVec15[1])) + (fSlow46 > fVec15[1]));
+			float fDecay0 = mydsp_decay_pole(fConst9, (fRec7[0] * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp7), ((fConst8 * (fConst6 - fTemp7)) + 1.0f))))));
+			float fDecayStep0 = ((fDecay0 - fDecayCoef0) / float(iCount));
 			float fTemp17 = float(iRec40[0]);
-			float fTemp18 = std::pow(0.00100000005f, (fConst9 / ((fRec39[0] * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp17), ((fConst8 * (fConst6 - fTemp17)) + 1.0f))))) + 0.0500000007f)));
-			float fTemp19 = (0.0f - (2.0f * fTemp18));
-			float fTemp20 = mydsp_faustpower2_f(fTemp18);
-			fRec35[0] = (fRec36[0] - (((fTemp19 * fRec35[1]) * fSlow53) + (fTemp20 * fRec35[2])));
-			fVec16[0] = fSlow54;
-			fRec41[0] = (fSlow54 + (fRec41[1] * float((fVec16[1] >= fSlow54))));
-			iRec42[0] = (iSlow55 * (iRec42[1] + 1));
-			fRec43[0] = (fRec36[0] - (((fTemp19 * fRec43[1]) * fSlow56) + (fTemp20 * fRec43[2])));
-			fVec17[0] = fSlow57;
-			fRec44[0] = (fSlow57 + (fRec44[1] * float((fVec17[1] >= fSlow57))));
-			iRec45[0] = (iSlow58 * (iRec45[1] + 1));
-			fRec46[0] = (fRec36[0] - (((fTemp19 * fRec46[1]) * fSlow59) + (fTemp20 * fRec46[2])));
-			fVec18[0] = fSlow60;
-			fRec47[0] = (fSlow60 + (fRec47[1] * float((fVec18[1] >= fSlow60))));
-			iRec48[0] = (iSlow61 * (iRec48[1] + 1));
-			fRec49[0] = (fRec36[0] - (((fTemp19 * fRec49[1]) * fSlow63) + (fTemp20 * fRec49[2])));
-			fVec19[0] = fSlow64;
-			fRec50[0] = (fSlow64 + (fRec50[1] * float((fVec19[1] >= fSlow64))));
-			iRec51[0] = (iSlow65 * (iRec51[1] + 1));
-			fRec52[0] = (fRec36[0] - (((fTemp19 * fRec52[1]) * fSlow66) + (fTemp20 * fRec52[2])));
-			fVec20[0] = fSlow67;
-			fRec53[0] = (fSlow67 + (fRec53[1] * float((fVec20[1] >= fSlow67))));
-			iRec54[0] = (iSlow68 * (iRec54[1] + 1));
-			fRec55[0] = (fRec36[0] - (((fRec55[1] * fTemp19) * fSlow69) + (fTemp20 * fRec55[2])));
-			fVec21[0] = fSlow70;
-			fRec56[0] = (fSlow70 + (fRec56[1] * float((fVec21[1] >= fSlow70))));
-			iRec57[0] = (iSlow71 * (iRec57[1] + 1));
-			fRec58[0] = (fRec36[0] - (((fTemp19 * fRec58[1]) * fSlow73) + (fTemp20 * fRec58[2])));
-			fVec22[0] = fSlow74;
-			fRec59[0] = (fSlow74 + (fRec59[1] * float((fVec22[1] >= fSlow74))));
-			iRec60[0] = (iSlow75 * (iRec60[1] + 1));
-			fRec61[0] = (fRec36[0] - (((fTemp19 * fRec61[1]) * fSlow76) + (fTemp20 * fRec61[2])));
-			fVec23[0] = fSlow77;
-			fRec62[0] = (fSlow77 + (fRec62[1] * float((fVec23[1] >= fSlow77))));
-			iRec63[0] = (iSlow78 * (iRec63[1] + 1));
-			fRec64[0] = (fRec36[0] - (((fTemp19 * fRec64[1]) * fSlow79) + (fTemp20 * fRec64[2])));
-			fVec24[0] = fSlow80;
-			fRec65[0] = (fSlow80 + (fRec65[1] * float((fVec24[1] >= fSlow80))));
-			iRec66[0] = (iSlow81 * (iRec66[1] + 1));
-			float fTemp21 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fSlow0 * (((fRec35[0] - fRec35[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec41[0]), 1.0f) - (fConst11 * float(iRec42[0]))))))) + (((fRec43[0] - fRec43[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec44[0]), 1.0f) - (fConst11 * float(iRec45[0]))))))) + (((fRec46[0] - fRec46[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec47[0]), 1.0f) - (fConst11 * float(iRec48[0]))))))) + (((fRec49[0] - fRec49[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec50[0]), 1.0f) - (fConst11 * float(iRec51[0]))))))) + (((fRec52[0] - fRec52[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec53[0]), 1.0f) - (fConst11 * float(iRec54[0]))))))) + (((fRec55[0] - fRec55[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec56[0]), 1.0f) - (fConst11 * float(iRec57[0]))))))) + ((((fRec58[0] - fRec58[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec59[0]), 1.0f) - (fConst11 * float(iRec60[0]))))))) + ((fRec61[0] - fRec61[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec62[0]), 1.0f) - (fConst11 * float(iRec63[0])))))))) + ((fRec64[0] - fRec64[2]) * mydsp_faustpower2_f((1.0f - std::max<float>(0.0f, (std::min<float>((fConst11 * fRec65[0]), 1.0f) - (fConst11 * float(iRec66[0]))))))))))))))) + ((fTemp11 * fTemp5) * fTemp14)))));
-			output1[i] = FAUSTFLOAT((fTemp21 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp21)))));
-			fRec2[1] = fRec2[0];
-			fRec3[1] = fRec3[0];
-			fVec0[1] = fVec0[0];
-			fRec5[1] = fRec5[0];
-			fRec4[1] = fRec4[0];
-			fVec1[1] = fVec1[0];
-			iRec6[1] = iRec6[0];
-			fVec2[1] = fVec2[0];
-			fRec1[1] = fRec1[0];
-			fRec7[1] = fRec7[0];
-			fVec3[1] = fVec3[0];
-			iRec8[1] = iRec8[0];
-			fRec0[2] = fRec0[1];
-			fRec0[1] = fRec0[0];
-			fVec4[1] = fVec4[0];
-			fRec9[1] = fRec9[0];
-			iRec10[1] = iRec10[0];
-			fRec11[2] = fRec11[1];
-			fRec11[1] = fRec11[0];
-			fVec5[1] = fVec5[0];
-			fRec12[1] = fRec12[0];
-			iRec13[1] = iRec13[0];
-			fRec14[2] = fRec14[1];
-			fRec14[1] = fRec14[0];
-			fVec6[1] = fVec6[0];
-			fRec15[1] = fRec15[0];
-			iRec16[1] = iRec16[0];
-			fRec17[2] = fRec17[1];
-			fRec17[1] = fRec17[0];
-			fVec7[1] = fVec7[0];
-			fRec18[1] = fRec18[0];
-			iRec19[1] = iRec19[0];
-			fRec20[2] = fRec20[1];
-			fRec20[1] = fRec20[0];
-			fVec8[1] = fVec8[0];
-			fRec21[1] = fRec21[0];
-			iRec22[1] = iRec22[0];
-			fRec23[2] = fRec23[1];
-			fRec23[1] = fRec23[0];
-			fVec9[1] = fVec9[0];
-			fRec24[1] = fRec24[0];
-			iRec25[1] = iRec25[0];
-			fRec26[2] = fRec26[1];
-			fRec26[1] = fRec26[0];
-			fVec10[1] = fVec10[0];
-			fRec27[1] = fRec27[0];
-			iRec28[1] = iRec28[0];
-			fRec29[2] = fRec29[1];
-			fRec29[1] = fRec29[0];
-			fVec11[1] = fVec11[0];
-			fRec30[1] = fRec30[0];
-			iRec31[1] = iRec31[0];
-			fRec32[2] = fRec32[1];
-			fRec32[1] = fRec32[0];
-			fVec12[1] = fVec12[0];
-			fRec33[1] = fRec33[0];
-			iRec34[1] = iRec34[0];
-			fVec13[1] = fVec13[0];
-			fRec38[1] = fRec38[0];
-			fRec37[1] = fRec37[0];
-			fVec14[1] = fVec14[0];
-			fRec36[1] = fRec36[0];
-			fRec39[1] = fRec39[0];
-			fVec15[1] = fVec15[0];
-			iRec40[1] = iRec40[0];
-			fRec35[2] = fRec35[1];
-			fRec35[1] = fRec35[0];
-			fVec16[1] = fVec16[0];
-			fRec41[1] = fRec41[0];
-			iRec42[1] = iRec42[0];
-			fRec43[2] = fRec43[1];
-			fRec43[1] = fRec43[0];
-			fVec17[1] = fVec17[0];
-			fRec44[1] = fRec44[0];
-			iRec45[1] = iRec45[0];
-			fRec46[2] = fRec46[1];
-			fRec46[1] = fRec46[0];
-			fVec18[1] = fVec18[0];
-			fRec47[1] = fRec47[0];
-			iRec48[1] = iRec48[0];
-			fRec49[2] = fRec49[1];
-			fRec49[1] = fRec49[0];
-			fVec19[1] = fVec19[0];
-			fRec50[1] = fRec50[0];
-			iRec51[1] = iRec51[0];
-			fRec52[2] = fRec52[1];
-			fRec52[1] = fRec52[0];
-			fVec20[1] = fVec20[0];
-			fRec53[1] = fRec53[0];
-			iRec54[1] = iRec54[0];
-			fRec55[2] = fRec55[1];
-			fRec55[1] = fRec55[0];
-			fVec21[1] = fVec21[0];
-			fRec56[1] = fRec56[0];
-			iRec57[1] = iRec57[0];
-			fRec58[2] = fRec58[1];
-			fRec58[1] = fRec58[0];
-			fVec22[1] = fVec22[0];
-			fRec59[1] = fRec59[0];
-			iRec60[1] = iRec60[0];
-			fRec61[2] = fRec61[1];
-			fRec61[1] = fRec61[0];
-			fVec23[1] = fVec23[0];
-			fRec62[1] = fRec62[0];
-			iRec63[1] = iRec63[0];
-			fRec64[2] = fRec64[1];
-			fRec64[1] = fRec64[0];
-			fVec24[1] = fVec24[0];
-			fRec65[1] = fRec65[0];
-			iRec66[1] = iRec66[0];
+			float fDecay1 = mydsp_decay_pole(fConst9, (fRec39[0] * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp17), ((fConst8 * (fConst6 - fTemp17)) + 1.0f))))));
+			float fDecayStep1 = ((fDecay1 - fDecayCoef1) / float(iCount));
+			for (int i = i0; (i < (i0 + iCount)); i = (i + 1)) {
+				fRec2[0] = (fSlow2 + (0.999000013f * fRec2[1]));
+				fRec3[0] = (fSlow3 + (0.999000013f * fRec3[1]));
+				float fTemp0 = (fRec2[0] * fRec3[0]);
+				float fTemp1 = float(input0[i]);
+				fVec0[0] = fTemp1;
+				fRec5[0] = ((fTemp1 + (0.995000005f * fRec5[1])) - fVec0[1]);
+				float fTemp2 = (fSlow4 * fRec5[0]);
+				float fTemp3 = std::fabs(fTemp2);
+				fRec4[0] = std::max<float>(fTemp3, ((fConst4 * fRec4[1]) + (fConst5 * fTemp3)));
+				fHbargraph0 = FAUSTFLOAT((fRec4[0] > fSlow5));
+				fVec1[0] = fSlow6;
+				iRec6[0] = ((fSlow6 > fVec1[1]) + ((fSlow6 <= fVec1[1]) * (iRec6[1] + (iRec6[1] > 0))));
+				float fTemp4 = float(iRec6[0]);
+				float fTemp5 = (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp4), ((fConst8 * (fConst6 - fTemp4)) + 1.0f))));
+				float fTemp6 = (fSlow1 * ((fTemp0 * fTemp2) * fTemp5));
+				fVec2[0] = fTemp6;
+				fRec1[0] = (0.0f - (fConst2 * ((fConst3 * fRec1[1]) - (fTemp6 + fVec2[1]))));
+				float fTemp8 = (fDecayCoef0 + (fDecayStep0 * float((i - i0) + 1)));
+				float fTemp9 = (0.0f - (2.0f * fTemp8));
+				float fTemp10 = mydsp_faustpower2_f(fTemp8);
+				float fTemp11 = (fRec2[0] * (1.0f - fRec3[0]));
+				float fTemp12 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fSlow0 * fBank0.tick(fRec1[0], fTemp9, fTemp10)) + ((fTemp11 * fTemp2) * fTemp5)))));
+				output0[i] = FAUSTFLOAT((fTemp12 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp12)))));
+				float fTemp13 = float(input1[i]);
+				fVec13[0] = fTemp13;
+				fRec38[0] = ((fTemp13 + (0.995000005f * fRec38[1])) - fVec13[1]);
+				float fTemp14 = (fSlow4 * fRec38[0]);
+				float fTemp15 = std::fabs(fTemp14);
+				fRec37[0] = std::max<float>(fTemp15, ((fConst4 * fRec37[1]) + (fConst5 * fTemp15)));
+				fHbargraph1 = FAUSTFLOAT((fRec37[0] > fSlow44));
+				float fTemp16 = (fSlow1 * ((fTemp0 * fTemp5) * fTemp14));
+				fVec14[0] = fTemp16;
+				fRec36[0] = (0.0f - (fConst2 * ((fConst3 * fRec36[1]) - (fTemp16 + fVec14[1]))));
+				float fTemp18 = (fDecayCoef1 + (fDecayStep1 * float((i - i0) + 1)));
+				float fTemp19 = (0.0f - (2.0f * fTemp18));
+				float fTemp20 = mydsp_faustpower2_f(fTemp18);
+				float fTemp21 = std::max<float>(-1.0f, std::min<float>(1.0f, (1.04712856f * ((fSlow0 * fBank1.tick(fRec36[0], fTemp19, fTemp20)) + ((fTemp11 * fTemp5) * fTemp14)))));
+				output1[i] = FAUSTFLOAT((fTemp21 * (1.0f - (0.333333343f * mydsp_faustpower2_f(fTemp21)))));
+				fRec2[1] = fRec2[0];
+				fRec3[1] = fRec3[0];
+				fVec0[1] = fVec0[0];
+				fRec5[1] = fRec5[0];
+				fRec4[1] = fRec4[0];
+				fVec1[1] = fVec1[0];
+				iRec6[1] = iRec6[0];
+				fVec2[1] = fVec2[0];
+				fRec1[1] = fRec1[0];
+				fVec13[1] = fVec13[0];
+				fRec38[1] = fRec38[0];
+				fRec37[1] = fRec37[0];
+				fVec14[1] = fVec14[0];
+				fRec36[1] = fRec36[0];
+			}
+			fDecayCoef0 = fDecay0;
+			fDecayCoef1 = fDecay1;
+		}
+#endif
+#endif
+#if DENORMAL_SNAP
+		mydsp_snap(fRec1[1]);
+		mydsp_snap(fRec2[1]);
+		mydsp_snap(fRec3[1]);
+		mydsp_snap(fRec4[1]);
+		mydsp_snap(fRec5[1]);
+		mydsp_snap(fRec7[1]);
+		mydsp_snap(fVec2[1]);
+		mydsp_snap(fVec14[1]);
+		mydsp_snap(fRec36[1]);
+		mydsp_snap(fRec37[1]);
+		mydsp_snap(fRec38[1]);
+		mydsp_snap(fRec39[1]);
+		mydsp_snap(fRec41[1]);
+		mydsp_snap(fRec42[1]);
+#endif
+		fBank0.cull();
+		fBank1.cull();
+	}
+	
+#if FIXED_POINT
+	// Fixed-point engine (see FIXED_POINT), one channel of interleaved stereo
+	// int32 frames. The structure is the one of the fused loop; the resonators
+	// have no denormals to cull in integer arithmetic.
+	void computeQ31Channel(int channel, int count, const int32_t* input, int32_t* output) {
+		mydsp_q31_channel& q = fQ31[channel];
+		q31modalbank& bank = ((channel == 0) ? fBankQ0 : fBankQ1);
+		int32_t iSlow5 = iControl[((channel == 0) ? 5 : 9)];
+		int32_t iSlow7 = iControl[((channel == 0) ? 7 : 10)];
+		int iSlow8 = iControl[((channel == 0) ? 8 : 11)];
+		int iTrig = 0;
+		for (int i0 = 0; (i0 < count); i0 = (i0 + DECAY_SUBBLOCK)) {
+			int iCount = std::min<int>(DECAY_SUBBLOCK, (count - i0));
+			for (int j = 0; (j < iCount); j = (j + 1)) {
+				q.iRec7 = (iSlow7 + q31_mul(2145336192, q.iRec7));
+				q.iRec8 = (((q.iRec8 + (q.iRec8 > 0)) * (iSlow8 <= q.iVec3)) + (iSlow8 > q.iVec3));
+				q.iVec3 = iSlow8;
+			}
+			// The pole is evaluated in float once per sub-block, and ramped in Q31
+			float fTemp7 = float(q.iRec8);
+			float fDecay = mydsp_decay_pole(fConst9, (q24_to_float(q.iRec7) * (1.0f - std::max<float>(0.0f, std::min<float>((fConst7 * fTemp7), ((fConst8 * (fConst6 - fTemp7)) + 1.0f))))));
+			int32_t iDecay = q31_from_float(fDecay);
+			int32_t iDecayStep = ((iDecay - q.iDecayCoef) / iCount);
+			for (int i = i0; (i < (i0 + iCount)); i = (i + 1)) {
+				q.iRec2 = (iControl[2] + q31_mul(2145336192, q.iRec2));
+				q.iRec3 = (iControl[3] + q31_mul(2145336192, q.iRec3));
+				// mode_changed envelope (Q31)
+				q.iRec6 = ((iControl[6] > q.iVec1) + ((iControl[6] <= q.iVec1) * (q.iRec6 + (q.iRec6 > 0))));
+				q.iVec1 = iControl[6];
+				int64_t iRamp = std::min<int64_t>((int64_t(iConst7) * q.iRec6), ((((int64_t(iConst6) - (int64_t(q.iRec6) << 24)) * iConst8) >> 24) + Q31_ONE));
+				int32_t iTemp5 = (Q31_ONE - int32_t(std::max<int64_t>(0, iRamp)));
+				// DC blocker and amplitude follower (Q24)
+				int32_t iTemp1 = (input[(2 * i)] >> 7);
+				q.iRec5 = q_sat(((int64_t(iTemp1) + q31_mul(2136746240, q.iRec5)) - q.iVec0));
+				q.iVec0 = iTemp1;
+				int32_t iTemp2 = q24_mul(iControl[4], q.iRec5);
+				int32_t iTemp3 = std::abs(iTemp2);
+				q.iRec4 = std::max<int32_t>(iTemp3, (q31_mul(iConst4, q.iRec4) + q31_mul(iConst5, iTemp3)));
+				iTrig = (q.iRec4 > iSlow5);
+				// Lowpass
+				int32_t iTemp6 = q31_mul(iControl[1], q31_mul(q24_mul(q24_mul(q.iRec2, q.iRec3), iTemp2), iTemp5));
+				q.iRec1 = q_sat((0 - int64_t(q31_mul(iConst2, q_sat(((int64_t(q24_mul(iConst3, q.iRec1)) - iTemp6) - q.iVec2))))));
+				q.iVec2 = iTemp6;
+				// Resonators
+				int32_t iTemp8 = (q.iDecayCoef + (iDecayStep * ((i - i0) + 1)));
+				int32_t iTemp10 = bank.tick(q.iRec1, iTemp8, q31_mul(iTemp8, iTemp8));
+				// Dry/wet mix and cubic soft clipper
+				int32_t iTemp11 = q24_mul(q.iRec2, (Q24_ONE - q.iRec3));
+				int32_t iTemp12 = std::max<int32_t>(-Q24_ONE, std::min<int32_t>(Q24_ONE, q24_mul(17567902, q_sat((int64_t(q31_mul(iControl[0], iTemp10)) + q31_mul(q24_mul(iTemp11, iTemp2), iTemp5))))));
+				int32_t iTemp13 = (iTemp12 - q24_mul(iTemp12, q24_mul(5592406, q24_mul(iTemp12, iTemp12))));
+				output[(2 * i)] = q_sat((int64_t(iTemp13) << 7));
+			}
+			q.iDecayCoef = iDecay;
 		}
+		if (channel == 0) {
+			fHbargraph0 = FAUSTFLOAT(iTrig);
+		} else {
+			fHbargraph1 = FAUSTFLOAT(iTrig);
+		}
+	}
+	
+	/*
+	 Compute 'count' interleaved stereo frames in fixed point: 'input' and
+	 'output' hold left/right int32 (Q31) samples, as read from and written to
+	 I2S, and can be the same buffer. Not to be mixed with compute on the same instance, each engine keeps
+	 its own state.
+	*/
+	void computeQ31(int count, const int32_t* input, int32_t* output) {
+		control(fBankQ0, fBankQ1);
+		iControl[0] = q31_from_float(fControl[0]);
+		iControl[1] = q31_from_float(fControl[1]);
+		iControl[2] = q24_from_float(fControl[2]);
+		iControl[3] = q24_from_float(fControl[3]);
+		iControl[4] = q24_from_float(fControl[4]);
+		iControl[5] = q24_from_float(fControl[5]);
+		iControl[6] = int(fControl[6] != 0.0f);
+		iControl[7] = q24_from_float(fControl[7]);
+		iControl[8] = int(fControl[8] != 0.0f);
+		iControl[9] = q24_from_float(fControl[9]);
+		iControl[10] = q24_from_float(fControl[10]);
+		iControl[11] = int(fControl[11] != 0.0f);
+		computeQ31Channel(0, count, input, output);
+		computeQ31Channel(1, count, &input[1], &output[1]);
 	}
+#endif
 
 };
 
+static_assert(alignof(mydsp) <= ARENA_ALIGN, "mydsp needs more alignment than ARENA_ALIGN");
+
 #ifdef FAUST_UIMACROS
 	
 	#define FAUST_FILE_NAME "Wingie.dsp"
@@ -11151,21 +12789,362 @@ std::list<GUI*> GUI::fGuiList;
 ztimedmap GUI::gTimedZoneMap;
 #endif
 
-Wingie::Wingie(int sample_rate, int buffer_size)
+#include <atomic>
+
+/**
+ * CPU governor for the resonator banks.
+ *
+ * Runs as a control callback of the audio task, between two blocks. When the
+ * measured DSP load gets close to the block period, the highest mode of each
+ * side is shed, one at a time. After an xrun, a quarter of them are shed at
+ * once. Modes are given back one at a time once the load has stayed low for
+ * GOVERNOR_RESTORE_MS.
+ */
+
+#ifndef GOVERNOR_HIGH_LOAD
+#define GOVERNOR_HIGH_LOAD 0.85f
+#endif
+#ifndef GOVERNOR_LOW_LOAD
+#define GOVERNOR_LOW_LOAD 0.6f
+#endif
+#ifndef GOVERNOR_RESTORE_MS
+#define GOVERNOR_RESTORE_MS 500
+#endif
+
+class modegovernor {
+
+    private:
+    
+        audio* fAudio;
+        mydsp* fDSP;
+        std::atomic<int> fRequested[2];     // mode count asked by the user for each side
+        int fShed;                          // modes currently removed from each side
+        int fHold;                          // blocks to wait for the load to reflect the last change
+        int fCalm;                          // consecutive blocks under GOVERNOR_LOW_LOAD
+        int fRestoreBlocks;
+        int fXRuns;                         // audio xruns seen so far
+        std::atomic<bool> fXRunShed;
+    
+        void update()
+        {
+            int left = fRequested[0];
+            int right = fRequested[1];
+            int max_shed = std::max<int>(left, right) - 1;
+            float load = fAudio->getCPULoad();
+            int xruns = fAudio->getXRuns();
+            
+            if (xruns != fXRuns && fXRunShed) {
+                // The load average reacts too slowly once blocks are lost
+                fShed += std::max<int>(1, (max_shed + 1) / 4);
+                fHold = 10;
+                fCalm = 0;
+            } else if (fHold > 0) {
+                fHold--;
+            } else if (load > GOVERNOR_HIGH_LOAD) {
+                fCalm = 0;
+                if (fShed < max_shed) {
+                    fShed++;
+                    fHold = 10; // time constant of the load average, in blocks
+                }
+            } else if (load < GOVERNOR_LOW_LOAD) {
+                if (fShed > 0 && ++fCalm >= fRestoreBlocks) {
+                    fShed--;
+                    fCalm = 0;
+                    fHold = 10;
+                }
+            } else {
+                fCalm = 0;
+            }
+            fShed = std::min<int>(fShed, max_shed);
+            fXRuns = xruns;
+            
+            left = std::max<int>(1, left - fShed);
+            right = std::max<int>(1, right - fShed);
+            if (left != fDSP->getNumModes(0) || right != fDSP->getNumModes(1)) {
+                fDSP->setNumModes(left, right);
+            }
+        }
+    
+    public:
+    
+        modegovernor(audio* audio, mydsp* dsp):fAudio(audio), fDSP(dsp), fShed(0), fHold(0), fCalm(0), fXRunShed(true)
+        {
+            fXRuns = fAudio->getXRuns();
+            fRequested[0] = fDSP->getNumModes(0);
+            fRequested[1] = fDSP->getNumModes(1);
+            fRestoreBlocks = std::max<int>(1, (GOVERNOR_RESTORE_MS * fAudio->getSampleRate()) / (1000 * fAudio->getBufferSize()));
+        }
+    
+        static void control(void* arg)
+        {
+            static_cast<modegovernor*>(arg)->update();
+        }
+    
+        void setNumModes(int left, int right)
+        {
+            fRequested[0] = std::max<int>(1, std::min<int>(left, MODALBANK_MAX_MODES));
+            fRequested[1] = std::max<int>(1, std::min<int>(right, MODALBANK_MAX_MODES));
+        }
+    
+        int getNumModes(int side) { return fDSP->getNumModes(side); }
+    
+        // Shed modes at once after an xrun (on by default)
+        void setXRunShed(bool shed) { fXRunShed = shed; }
+    
+};
+
+/**
+ * Workers for the split channel mode of mydsp (see mydsp::setWorker).
+ *
+ * The handshake is lock-free: post() publishes the job and increments fPosted
+ * (release), the worker runs it and copies fPosted to fDone (release), wait()
+ * spins on fDone (acquire). The platform is only used to wake the worker up,
+ * so the audio task never blocks on a lock held by the other side.
+ */
+
+#ifndef SPLIT_CHANNELS
+#define SPLIT_CHANNELS 0    // 1 to render the right channel on the second core of the ESP32
+#endif
+
+// Spin loop hint: lets the other hyperthread run on x86, and saves power
+static inline void splitworker_pause()
+{
+#if defined(__SSE2__)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#elif defined(__XTENSA__)
+    __asm__ __volatile__("nop");
+#endif
+}
+
+class splitworker : public mydsp_worker {
+
+    protected:
+    
+        std::atomic<unsigned> fPosted;
+        std::atomic<unsigned> fDone;
+        std::atomic<bool> fRunning;
+        void (*fJob)(void*);
+        void* fArg;
+    
+        // Run the last posted job if it has not been run yet
+        void runPosted()
+        {
+            unsigned posted = fPosted.load(std::memory_order_acquire);
+            if (posted != fDone.load(std::memory_order_relaxed)) {
+                fJob(fArg);
+                fDone.store(posted, std::memory_order_release);
+            }
+        }
+    
+        virtual void notify() {}
+    
+    public:
+    
+        splitworker():fPosted(0), fDone(0), fRunning(false), fJob(nullptr), fArg(nullptr) {}
+        virtual ~splitworker() {}
+    
+        virtual void post(void (*job)(void*), void* arg)
+        {
+            fJob = job;
+            fArg = arg;
+            fPosted.fetch_add(1, std::memory_order_release);
+            notify();
+        }
+    
+        // Spins, the job being a fraction of the block: sleeping would take longer than the job itself
+        virtual void wait()
+        {
+            unsigned posted = fPosted.load(std::memory_order_relaxed);
+            while (fDone.load(std::memory_order_acquire) != posted) {
+                splitworker_pause();
+            }
+        }
+    
+};
+
+#ifdef ESP_PLATFORM
+
+// Worker task pinned to the other core, woken by a task notification
+class esp32worker : public splitworker {
+
+    private:
+    
+        TaskHandle_t fHandle;
+        std::atomic<bool> fExited;
+    
+        static void workerTaskHandler(void* arg)
+        {
+            esp32worker* worker = static_cast<esp32worker*>(arg);
+            AVOIDDENORMALS;
+            while (worker->fRunning) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                worker->runPosted();
+            }
+            worker->fExited = true;
+            // Task has to deleted itself beforee returning
+            vTaskDelete(nullptr);
+        }
+    
+        virtual void notify() { xTaskNotifyGive(fHandle); }
+    
+    public:
+    
+        esp32worker():fHandle(nullptr), fExited(false) {}
+        virtual ~esp32worker() { stop(); }
+    
+        /*
+         On the core of the Arduino loop (priority 1), just above it: the task
+         sleeps between jobs, and a higher priority would also hold off the
+         tasks of that core which have to run between blocks.
+        */
+        bool start(int core = 1, int priority = 2)
+        {
+            if (portNUM_PROCESSORS < 2) return false;
+            fRunning = true;
+            fExited = false;
+            if (xTaskCreatePinnedToCore(workerTaskHandler, "Faust DSP Worker", 4096, (void*)this, priority, &fHandle, core) != pdPASS) {
+                fRunning = false;
+                fHandle = nullptr;
+                return false;
+            }
+            return true;
+        }
+    
+        // Only call once the audio task does not post anymore, returns when the task has exited
+        void stop()
+        {
+            if (fRunning) {
+                fRunning = false;
+                xTaskNotifyGive(fHandle);
+                while (!fExited) {
+                    vTaskDelay(1);
+                }
+            }
+        }
+    
+};
+
+#else
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Host thread sleeping on a condition variable between jobs, for the two-thread pipeline of the host builds
+class threadworker : public splitworker {
+
+    private:
+    
+        std::thread fThread;
+        std::mutex fMutex;
+        std::condition_variable fCond;
+    
+        virtual void notify()
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fCond.notify_one();
+        }
+    
+        bool hasWork()
+        {
+            return !fRunning || fPosted.load(std::memory_order_acquire) != fDone.load(std::memory_order_relaxed);
+        }
+    
+    public:
+    
+        virtual ~threadworker() { stop(); }
+    
+        // Fails on single core hosts, where the two threads would only take turns
+        bool start()
+        {
+            if (std::thread::hardware_concurrency() < 2) return false;
+            fRunning = true;
+            fThread = std::thread([this] {
+                AVOIDDENORMALS;
+                while (fRunning) {
+                    {
+                        std::unique_lock<std::mutex> lock(fMutex);
+                        fCond.wait(lock, [this] { return hasWork(); });
+                    }
+                    runPosted();
+                }
+            });
+            return true;
+        }
+    
+        void stop()
+        {
+            if (fRunning) {
+                fRunning = false;
+                notify();
+                fThread.join();
+            }
+        }
+    
+};
+
+#endif
+
+#ifdef ESP_PLATFORM
+
+Wingie::Wingie(int sample_rate, int buffer_size, WingieLatency latency, int i2s_bits)
 {
+    // The DSP state and the audio buffers in one block of internal RAM
+    fArena = new dsparena();
 #ifdef NVOICES
+    fArena->reserve(esp32audio::getArenaSize(AUDIO_MAX_CHAN, AUDIO_MAX_CHAN, buffer_size));
     int nvoices = NVOICES;
     mydsp_poly* dsp_poly = new mydsp_poly(new mydsp(), nvoices, true, true);
     fDSP = dsp_poly;
+    fGovernor = nullptr;
+    fWorker = nullptr;
 #else
-    fDSP = new mydsp();
+    fArena->reserve(dsparena::align(sizeof(mydsp)) + esp32audio::getArenaSize(AUDIO_MAX_CHAN, AUDIO_MAX_CHAN, buffer_size));
+    mydsp* resonators = mydsp::create(fArena);
+    fDSP = resonators;
+#if SPLIT_CHANNELS
+    fWorker = new esp32worker();
+    if (fWorker->start()) {
+        resonators->setWorker(fWorker);
+    }
+#else
+    fWorker = nullptr;
+#endif
 #endif
     
     fUI = new MapUI();
     fDSP->buildUserInterface(fUI);
-    
-    fAudio = new esp32audio(sample_rate, buffer_size);
+    fParams = new paramqueue();
+    
+    // DMA buffers and audio task priority of each latency profile, one priority
+    // step apart from the top (24 on Arduino-ESP32): the normal one shares the
+    // priority of the Wi-Fi task (23), the safe one leaves it over the audio
+    // task, its deeper buffers absorbing the delay
+    switch (latency) {
+        case kLatencyUltraLow:
+            fAudio = new esp32audio(sample_rate, buffer_size, 2, configMAX_PRIORITIES - 1, i2s_bits, fArena);
+            break;
+        case kLatencySafe:
+            fAudio = new esp32audio(sample_rate, buffer_size, 6, configMAX_PRIORITIES - 3, i2s_bits, fArena);
+            break;
+        default:
+            fAudio = new esp32audio(sample_rate, buffer_size, 3, configMAX_PRIORITIES - 2, i2s_bits, fArena);
+            break;
+    }
     fAudio->init("esp32", fDSP);
+    fAudio->setParamQueue(fParams);
+#if FIXED_POINT && !defined(NVOICES)
+    fAudio->setRawCompute([](void* arg, int count, const int32_t* input, int32_t* output) {
+        static_cast<mydsp*>(arg)->computeQ31(count, input, output);
+    }, resonators);
+#endif
+    
+#ifndef NVOICES
+    fGovernor = new modegovernor(fAudio, resonators);
+    fAudio->addControlCallback(modegovernor::control, fGovernor);
+#endif
     
 #ifdef SOUNDFILE
     fSoundUI = new SoundUI("/sdcard/", sample_rate);
@@ -11184,9 +13163,18 @@ Wingie::Wingie(int sample_rate, int buffer_size)
 
 Wingie::~Wingie()
 {
+    // The audio task is done with the DSP and the arena before they go
+    fAudio->stop();
+#ifdef NVOICES
     delete fDSP;
+#else
+    mydsp::destroy(static_cast<mydsp*>(fDSP), fArena);
+#endif
     delete fUI;
     delete fAudio;
+    delete fParams;
+    delete fGovernor;
+    delete fWorker;
 #ifdef MIDICTRL
     delete fMIDIInterface;
     delete fMIDIHandler;
@@ -11194,6 +13182,8 @@ Wingie::~Wingie()
 #ifdef SOUNDFILE
     delete fSoundUI;
 #endif
+    // Last, the DSP and the audio buffers are in it
+    delete fArena;
 }
 
 bool Wingie::start()
@@ -11210,11 +13200,41 @@ void Wingie::stop()
     fMIDIInterface->stop();
 #endif
     fAudio->stop();
+    // The audio task has exited, the queue has no consumer left: what it left is applied here, so
+    // that the changes made from now on are not overwritten at the next start
+    fParams->flush();
+}
+
+/*
+ The zones are written by the audio task alone while it runs. When the queue
+ is full, the control loop waits for the audio task to drain it, unless
+ changes are held back by beginParams: they would then have to be sent
+ before the end of the group, so the change is refused instead and the
+ group stays whole.
+*/
+bool Wingie::queueParam(float* zone, float value, int64_t date)
+{
+    if (!fAudio->isRunning()) {
+        *zone = value;
+        return true;
+    }
+    uint32_t frame = (date < 0) ? fParams->getTime() : fParams->getDate(uint32_t(date), fAudio->getSampleRate());
+    while (!fParams->push(zone, value, frame)) {
+        if (fParams->isHolding()) return false;
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+bool WingieParam::set(float value, int64_t date) const
+{
+    return (fZone) ? fOwner->queueParam(fZone, value, date) : false;
 }
 
-void Wingie::setParamValue(const std::string& path, float value)
+bool Wingie::setParamValue(const std::string& path, float value, int64_t date)
 {
-    fUI->setParamValue(path, value);
+    float* zone = fUI->getParamZone(path);
+    return (zone) ? queueParam(zone, value, date) : false;
 }
 
 float Wingie::getParamValue(const std::string& path)
@@ -11222,6 +13242,74 @@ float Wingie::getParamValue(const std::string& path)
     return fUI->getParamValue(path);
 }
 
+WingieParam Wingie::getParam(const std::string& path)
+{
+    return WingieParam(fUI->getParamZone(path), this);
+}
+
+void Wingie::beginParams()
+{
+    fParams->begin();
+}
+
+void Wingie::endParams()
+{
+    fParams->end();
+}
+
+void Wingie::setNumModes(int left, int right)
+{
+    if (fGovernor) fGovernor->setNumModes(left, right);
+}
+
+int Wingie::getNumModes(int side)
+{
+    return (fGovernor) ? fGovernor->getNumModes(side) : NHARMONICS;
+}
+
+int Wingie::getI2SBits()
+{
+    return fAudio->getBits();
+}
+
+int Wingie::getLatency()
+{
+    return fAudio->getLatency();
+}
+
+int Wingie::measureLatency()
+{
+    return fAudio->measureLatency(fAudio->getSampleRate());
+}
+
+float Wingie::getCPULoad()
+{
+    return fAudio->getCPULoad();
+}
+
+bool Wingie::getStats(audiostats& stats, bool reset)
+{
+    return fAudio->getStats(stats, reset);
+}
+
+int Wingie::getOverruns()
+{
+    return fAudio->getOverruns();
+}
+
+int Wingie::getUnderruns()
+{
+    return fAudio->getUnderruns();
+}
+
+void Wingie::setXRunPolicy(int policy)
+{
+    fAudio->setXRunFade(policy & kXRunFade);
+    if (fGovernor) fGovernor->setXRunShed(policy & kXRunShed);
+}
+
+#endif // ESP_PLATFORM
+
 // Entry point
 #ifdef HAS_MAIN
 extern "C" void app_main()
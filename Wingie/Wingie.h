@@ -27,13 +27,22 @@
 #define faust_Wingie_h_
 
 #include <string>
+#include <stdint.h>
+#ifdef ESP_PLATFORM
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/i2s.h"
+#endif
 
 class dsp;
 class esp32audio;
 class MapUI;
+class modegovernor;
+class esp32worker;
+class audiostats;
+class dsparena;
+class paramqueue;
+class Wingie;
 #ifdef MIDICTRL
 class MidiUI;
 class esp32_midi;
@@ -42,13 +51,55 @@ class esp32_midi;
 class SoundUI;
 #endif
 
+// I2S latency profiles (DMA buffers and audio task priority), from the lowest latency to the most margin
+enum WingieLatency {
+    kLatencyUltraLow,   // 2 DMA buffers, highest task priority
+    kLatencyNormal,     // 3 DMA buffers, task priority of the Wi-Fi task
+    kLatencySafe        // 6 DMA buffers, task priority under the Wi-Fi task
+};
+
+// What the audio task does after an xrun, a block lost because it was late (flags)
+enum WingieXRunPolicy {
+    kXRunCount = 0,     // only count it
+    kXRunFade = 1,      // fade the next block in from silence instead of a step
+    kXRunShed = 2       // shed a quarter of the resonator modes at once, given back when the load is low again
+};
+
+/*
+ Handle of a DSP parameter, from Wingie::getParam: the path is looked up
+ once, then the parameter is set and read without building a string or
+ searching the parameter maps. set goes through the queue of the audio task
+ like Wingie::setParamValue, with the same optional date, get reads the value
+ the DSP has now. An unknown path gives an invalid handle, on which set does
+ nothing and returns false, and get returns 0.
+*/
+class WingieParam
+{
+    private:
+    
+        float* fZone;
+        Wingie* fOwner;
+    
+    public:
+    
+        WingieParam(float* zone = nullptr, Wingie* owner = nullptr):fZone(zone), fOwner(owner) {}
+    
+        bool isValid() const { return fZone != nullptr; }
+        bool set(float value, int64_t date = -1) const;
+        float get() const { return (fZone) ? *fZone : 0.f; }
+};
+
 class Wingie
 {
     private:
     
+        dsparena* fArena;
         esp32audio* fAudio;
+        paramqueue* fParams;
     	dsp* fDSP;
         MapUI* fUI;
+        modegovernor* fGovernor;
+        esp32worker* fWorker;
     #ifdef MIDICTRL
         esp32_midi* fMIDIHandler;        
         MidiUI* fMIDIInterface;
@@ -56,17 +107,61 @@ class Wingie
     #ifdef SOUNDFILE
         SoundUI* fSoundUI;
     #endif
+    
+        bool queueParam(float* zone, float value, int64_t date);
+    
+        friend class WingieParam;
 
     public:
     
-        Wingie(int sample_rate, int buffer_size);
+        // 'i2s_bits' is the I2S sample width (32, 24 or 16), the codec has to be set to the same word size
+        Wingie(int sample_rate, int buffer_size, WingieLatency latency = kLatencyNormal, int i2s_bits = 32);
         ~Wingie();
     
         bool start();
         void stop();
     
-        void setParamValue(const std::string&, float);
+        /*
+         Changes are queued and applied by the audio task. Without a date, at the
+         start of its next block. With the esp_timer_get_time() date of the event
+         that caused the change (a key press), on the frame due one block after
+         it: the latency of the change is then the same whenever it happens in
+         the block, rather than up to a block of jitter. False for an unknown
+         path, or when the queue is full between beginParams and endParams: the
+         change is dropped and the ones before it in the group are kept, to be
+         sent at endParams.
+        */
+        bool setParamValue(const std::string& path, float value, int64_t date = -1);
         float getParamValue(const std::string& path);
+        // For the parameters set or read over and over, see WingieParam
+        WingieParam getParam(const std::string& path);
+        // The changes made between begin and end reach the DSP in the same block (can be nested)
+        void beginParams();
+        void endParams();
+    
+        // Resonator modes per side (1 to 32), lowered by the CPU governor when the audio task runs late
+        void setNumModes(int left, int right);
+        int getNumModes(int side);
+    
+        int getI2SBits();
+    
+        // Input to output latency in frames, from the I2S buffering of the latency profile
+        int getLatency();
+        // Measured with an impulse, including the codec: patch an output to the left input first.
+        // The outputs are muted for the measure, -1 if the impulse is not heard within a second.
+        int measureLatency();
+    
+        // Smoothed proportion of the block period spent computing (above 1 when the audio task is late)
+        float getCPULoad();
+        // Timing of each phase of the audio task since the last reset (see audiostats.h), false during
+        // the first 100 ms. Copied by the audio task at the end of a block, so this waits for one block.
+        bool getStats(audiostats& stats, bool reset = false);
+    
+        // Input blocks dropped and output blocks played without new data, since the start
+        int getOverruns();
+        int getUnderruns();
+        // Flags of WingieXRunPolicy, kXRunFade | kXRunShed by default
+        void setXRunPolicy(int policy);
 };
 
 #endif
@@ -3,11 +3,15 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/i2c.h"
+#include "esp_timer.h"
 
 #include "AC101.h"
 #include "TCA6424A.h"
 #include <Wire.h>
 #include "Wingie.h"
+#include "audiostats.h"
+#include "potinput.h"
+#include "adcsampler.h"
 #include "WiFi.h"
 
 #define BASE_NOTE 48
@@ -23,7 +27,9 @@
 #define POLY_MODE_NOTE_ADD_L 12
 #define POLY_MODE_NOTE_ADD_R 24
 
-Wingie dsp(44100, 32);
+#define I2S_BITS 32 // I2S sample width: 32, 24 or 16
+
+Wingie dsp(44100, 32, kLatencyNormal, I2S_BITS);
 AC101 ac;
 TCA6424A tca;
 
@@ -32,10 +38,14 @@ const int lOctPin[2] = {13, 14};
 const int rOctPin[2] = {23, 19};
 const int routePin[2] = {4, 5}, sourcePin = 18, interruptPin = 15;
 const int potPin[3] = {34, 36, 39};
+adcsampler potSampler(potPin, 3); // reads the pots in the background
+uint32_t potScans = 0;
+potinput pots[3] = {potinput(ADC_FULL_SCALE), potinput(ADC_FULL_SCALE), potinput(ADC_FULL_SCALE)}; // mix, decay, volume: the parameters are only sent when the pots move
 const int sources[2] = {0x2020, 0x0408}; // MIC, LINE
 const float inputGainFactor[2] = {2., 1.};
 
 volatile bool keyChanged = 0;
+volatile int64_t keyChangedTime = 0; // esp_timer date of the key interrupt, to date the changes it causes
 bool source, key[2][12], keyPrev[2][12], firstPress[2] = {true, true};
 bool routeButtonPressed[2], routeChanging[2] = {false, false}, sourceChanged = false, sourceChanged2 = false, volumeRaise = false;
 bool muteStatus[2][9];
@@ -48,6 +58,16 @@ int seq[2][12], seqLen[2] = {0, 0}, playHeadPos[2] = {0, 0}, writeHeadPos[2] = {
 
 unsigned long currentMillis, tcaReadMillis = 0, sourceChangedMillis = 0, startupMillis = 0;
 
+// Parameters set from the loop, resolved once in setup (see WingieParam)
+WingieParam mixParam, inputGainParam, inputGainFactorParam;
+WingieParam noteParam[2], decayParam[2], modeChangedParam[2], routeParam[2], thresholdParam[2], trigParam[2];
+WingieParam polyNoteParam[2][3], muteParam[2][9];
+
+// Serial commands
+char serialLine[32];
+int serialLength = 0;
+audiostats stats;
+
 bool startup = true; // startup
 
 void setup() {
@@ -89,9 +109,14 @@ void setup() {
   }
   Serial.println("AC101 : Connection OK!");
 
+  // begin() sets 24-bit words, which the 32-bit I2S samples carry too
+  ac.SetI2sWordSize((dsp.getI2SBits() == 16) ? AC101::WORD_SIZE_16_BITS : AC101::WORD_SIZE_24_BITS);
+
   ac.SetVolumeHeadphone(volume);
   ac.SetVolumeSpeaker(0);
 
+  resolveParams();
+
   source = !digitalRead(sourcePin);
   acWriteReg(ADC_SRC, sources[source]);
   dsp.setParamValue("/Wingie/input_gain_factor", inputGainFactor[source]);
@@ -99,6 +124,7 @@ void setup() {
   //ac.DumpRegisters();
 
   dsp.start();
+  potSampler.start();
   dsp.setParamValue("resonator_input_gain", 0.1);
   dsp.setParamValue("resonator_output_gain", 0.4);
   dsp.setParamValue("route0", 0);
@@ -134,6 +160,8 @@ void setup() {
 void loop() {
   interrupts();
   currentMillis = millis();
+  // The parameter changes of a pass reach the DSP together
+  dsp.beginParams();
 
 
   //
@@ -154,16 +182,28 @@ void loop() {
   //
   // Interface Reading
   //
-  float Mix = (1. - analogRead(potPin[0]) / 4095.);
-  dsp.setParamValue("mix", Mix);
+  // New pot values after each scan of the sampler
+  uint32_t scans = potSampler.getScans();
+  if (scans != potScans) {
+    potScans = scans;
+
+    if (pots[0].update(potSampler.getValue(0))) {
+      float Mix = (1. - pots[0].getPosition());
+      mixParam.set(Mix);
+    }
 
-  float Decay = (1. - analogRead(potPin[1]) / 4095.) * 9.9 + 0.1;
-  Decay = fscale(0.1, 10., 0.1, 10., Decay, -3.25);
-  dsp.setParamValue("/Wingie/left/decay", Decay);
-  dsp.setParamValue("/Wingie/right/decay", Decay);
+    if (pots[1].update(potSampler.getValue(1))) {
+      float Decay = (1. - pots[1].getPosition()) * 9.9 + 0.1;
+      Decay = fscale(0.1, 10., 0.1, 10., Decay, -3.25);
+      decayParam[0].set(Decay);
+      decayParam[1].set(Decay);
+    }
 
-  float Volume = (1. - analogRead(potPin[2]) / 4095.);
-  dsp.setParamValue("input_gain", Volume);
+    if (pots[2].update(potSampler.getValue(2))) {
+      float Volume = (1. - pots[2].getPosition());
+      inputGainParam.set(Volume);
+    }
+  }
 
   bool tmp = !digitalRead(sourcePin);
 
@@ -175,8 +215,8 @@ void loop() {
     source = tmp;
     sourceChanged = true;
     ac.SetVolumeHeadphone(0);
-    dsp.setParamValue("/Wingie/left/mode_changed", 1);
-    dsp.setParamValue("/Wingie/right/mode_changed", 1);
+    modeChangedParam[0].set(1);
+    modeChangedParam[1].set(1);
     sourceChangedMillis = currentMillis;
   }
 
@@ -185,7 +225,7 @@ void loop() {
       sourceChanged = false;
       sourceChanged2 = true;
       acWriteReg(ADC_SRC, sources[source]);
-      dsp.setParamValue("/Wingie/input_gain_factor", inputGainFactor[source]);
+      inputGainFactorParam.set(inputGainFactor[source]);
       sourceChangedMillis = currentMillis;
     }
   }
@@ -194,8 +234,8 @@ void loop() {
     if (currentMillis - sourceChangedMillis > 50) {
       sourceChanged2 = false;
       ac.SetVolumeHeadphone(volume);
-      dsp.setParamValue("/Wingie/left/mode_changed", 0);
-      dsp.setParamValue("/Wingie/right/mode_changed", 0);
+      modeChangedParam[0].set(0);
+      modeChangedParam[1].set(0);
     }
   }
 
@@ -214,10 +254,10 @@ void loop() {
       octPrev[i] = oct[i];
       switch (i) {
         case 0 :
-          dsp.setParamValue("note0", note[0] + BASE_NOTE + oct[0] * 12);
+          noteParam[0].set(note[0] + BASE_NOTE + oct[0] * 12);
           break;
         case 1 :
-          dsp.setParamValue("note1", note[1] + BASE_NOTE + oct[1] * 12 + 12);
+          noteParam[1].set(note[1] + BASE_NOTE + oct[1] * 12 + 12);
           break;
       }
     }
@@ -234,8 +274,7 @@ void loop() {
       if (routeButtonPressed[kb] && !threshChanged[kb]) routeChanging[kb] = true;
       threshChanged[kb] = false;
       routeButtonPressed[kb] = false;
-      if (!kb) dsp.setParamValue("/Wingie/left/mode_changed", 0);
-      if (kb) dsp.setParamValue("/Wingie/right/mode_changed", 0);
+      modeChangedParam[kb].set(0);
     }
 
     if (routeChanging[kb]) {
@@ -243,22 +282,18 @@ void loop() {
       if (route[kb] < MODE_NUM) route[kb] += 1;
       else route[kb] = 0;
       if (!kb) {
-        dsp.setParamValue("route0", route[kb]);
-        dsp.setParamValue("/Wingie/left/mode_changed", 1);
+        routeParam[0].set(route[kb]);
+        modeChangedParam[0].set(1);
       }
       if (kb) {
-        dsp.setParamValue("route1", route[kb]);
-        dsp.setParamValue("/Wingie/right/mode_changed", 1);
+        routeParam[1].set(route[kb]);
+        modeChangedParam[1].set(1);
       }
 
       if (route[kb] != REQ_MODE) {
         for (int i = 0; i < 9; i++) {
           muteStatus[kb][i] = false;
-          char buff[100];
-          if (!kb) snprintf(buff, sizeof(buff), "/Wingie/left/mute_%d", i);
-          else snprintf(buff, sizeof(buff), "/Wingie/right/mute_%d", i);
-          const std::string str = buff;
-          dsp.setParamValue(str, false);
+          muteParam[kb][i].set(false);
         }
       }
 
@@ -270,6 +305,7 @@ void loop() {
   // Note Change
   //
   if (keyChanged || currentMillis - tcaReadMillis > 100) {
+    int64_t keyTime = (keyChanged) ? keyChangedTime : esp_timer_get_time();
     keyChanged = 0;
     tcaReadMillis = currentMillis;
 
@@ -288,12 +324,7 @@ void loop() {
             if (routeButtonPressed[kb]) { // Changle threshold
               threshChanged[kb] = true;
               float thresh = 0.0833 * i + 0.0833;
-              if (!kb) {
-                dsp.setParamValue("left_threshold", thresh);
-              };
-              if (kb) {
-                dsp.setParamValue("right_threshold", thresh);
-              };
+              thresholdParam[kb].set(thresh);
             }
             else {
               //if (!kb) dsp.setParamValue("/Wingie/left/mode_changed", 1);
@@ -308,8 +339,8 @@ void loop() {
                   seqLen[kb] = 0;
                   playHeadPos[kb] = 0;
                   writeHeadPos[kb] = 0;
-                  if (!kb) dsp.setParamValue("note0", note[kb] + BASE_NOTE + oct[kb] * 12);
-                  if (kb) dsp.setParamValue("note1", note[kb] + BASE_NOTE + oct[kb] * 12 + 12);
+                  if (!kb) noteParam[0].set(note[kb] + BASE_NOTE + oct[kb] * 12, keyTime);
+                  if (kb) noteParam[1].set(note[kb] + BASE_NOTE + oct[kb] * 12 + 12, keyTime);
                 }
               }
               else { // Not First Press
@@ -318,8 +349,8 @@ void loop() {
                   writeHeadPos[kb] += 1;
                   seqLen[kb] += 1;
                   seq[kb][writeHeadPos[kb]] = i;
-                  if (!kb) dsp.setParamValue("note0", note[kb] + BASE_NOTE + oct[kb] * 12);
-                  if (kb) dsp.setParamValue("note1", note[kb] + BASE_NOTE + oct[kb] * 12 + 12);
+                  if (!kb) noteParam[0].set(note[kb] + BASE_NOTE + oct[kb] * 12, keyTime);
+                  if (kb) noteParam[1].set(note[kb] + BASE_NOTE + oct[kb] * 12 + 12, keyTime);
                 }
               }
 
@@ -329,29 +360,25 @@ void loop() {
                   if (i > 6) key = i - 3;
                   else key = i;
                   muteStatus[kb][key] = !muteStatus[kb][key];
-                  char buff[100];
-                  if (!kb) snprintf(buff, sizeof(buff), "/Wingie/left/mute_%d", key);
-                  else snprintf(buff, sizeof(buff), "/Wingie/right/mute_%d", key);
-                  const std::string str = buff;
-                  dsp.setParamValue(str, muteStatus[kb][key]);
+                  muteParam[kb][key].set(muteStatus[kb][key], keyTime);
                 }
               }
 
               if (route[kb] == POLY_MODE) {
                 if (currentPoly[kb] == 0) {
                   currentPoly[kb] = 1;
-                  if (!kb) dsp.setParamValue("/Wingie/left/poly_note_0", i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_L);
-                  if (kb) dsp.setParamValue("/Wingie/right/poly_note_0", i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_R);
+                  if (!kb) polyNoteParam[0][0].set(i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_L, keyTime);
+                  if (kb) polyNoteParam[1][0].set(i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_R, keyTime);
                 }
                 else if (currentPoly[kb] == 1) {
                   currentPoly[kb] = 2;
-                  if (!kb) dsp.setParamValue("/Wingie/left/poly_note_1", i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_L);
-                  if (kb) dsp.setParamValue("/Wingie/right/poly_note_1", i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_R);
+                  if (!kb) polyNoteParam[0][1].set(i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_L, keyTime);
+                  if (kb) polyNoteParam[1][1].set(i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_R, keyTime);
                 }
                 else if (currentPoly[kb] == 2) {
                   currentPoly[kb] = 0;
-                  if (!kb) dsp.setParamValue("/Wingie/left/poly_note_2", i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_L);
-                  if (kb) dsp.setParamValue("/Wingie/right/poly_note_2", i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_R);
+                  if (!kb) polyNoteParam[0][2].set(i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_L, keyTime);
+                  if (kb) polyNoteParam[1][2].set(i + BASE_NOTE + oct[kb] * 12 + POLY_MODE_NOTE_ADD_R, keyTime);
                 }
               }
 
@@ -400,8 +427,9 @@ void loop() {
   //
   // Tap Sequencer
   //
-  trig[0] = dsp.getParamValue("/Wingie/left_trig");
-  trig[1] = dsp.getParamValue("/Wingie/right_trig");
+  trig[0] = trigParam[0].get();
+  trig[1] = trigParam[1].get();
+  int64_t trigTime = esp_timer_get_time();
 
   for (int kb = 0; kb < 2; kb++) {
     if (seqLen[kb]) {
@@ -410,21 +438,106 @@ void loop() {
         if (playHeadPos[kb] < seqLen[kb]) playHeadPos[kb] += 1;
         else playHeadPos[kb] = 0;
         note[kb] = seq[kb][playHeadPos[kb]];
-        if (!kb) dsp.setParamValue("note0", note[kb] + BASE_NOTE + oct[kb] * 12);
-        if (kb) dsp.setParamValue("note1", note[kb] + BASE_NOTE + oct[kb] * 12 + 12);
-        if (!kb) dsp.setParamValue("/Wingie/left/mode_changed", 1);
-        if (kb) dsp.setParamValue("/Wingie/right/mode_changed", 1);
+        if (!kb) noteParam[0].set(note[kb] + BASE_NOTE + oct[kb] * 12, trigTime);
+        if (kb) noteParam[1].set(note[kb] + BASE_NOTE + oct[kb] * 12 + 12, trigTime);
+        modeChangedParam[kb].set(1, trigTime);
       }
     }
     if (!trig[kb] && trigged[kb]) {
       trigged[kb] = false;
-      if (!kb) dsp.setParamValue("/Wingie/left/mode_changed", 0);
-      if (kb) dsp.setParamValue("/Wingie/right/mode_changed", 0);
+      modeChangedParam[kb].set(0, trigTime);
     }
   }
 
+
+  //
+  // Serial Commands
+  //
+  readSerial();
+
+  dsp.endParams();
+}
+
+void resolveParams() {
+  const char* sides[2] = {"left", "right"};
+  char path[40];
+  mixParam = dsp.getParam("/Wingie/mix");
+  inputGainParam = dsp.getParam("/Wingie/input_gain");
+  inputGainFactorParam = dsp.getParam("/Wingie/input_gain_factor");
+  for (int kb = 0; kb < 2; kb++) {
+    snprintf(path, sizeof(path), "/Wingie/%s/note%d", sides[kb], kb);
+    noteParam[kb] = dsp.getParam(path);
+    snprintf(path, sizeof(path), "/Wingie/%s/decay", sides[kb]);
+    decayParam[kb] = dsp.getParam(path);
+    snprintf(path, sizeof(path), "/Wingie/%s/mode_changed", sides[kb]);
+    modeChangedParam[kb] = dsp.getParam(path);
+    snprintf(path, sizeof(path), "/Wingie/%s/route%d", sides[kb], kb);
+    routeParam[kb] = dsp.getParam(path);
+    snprintf(path, sizeof(path), "/Wingie/%s_threshold", sides[kb]);
+    thresholdParam[kb] = dsp.getParam(path);
+    snprintf(path, sizeof(path), "/Wingie/%s_trig", sides[kb]);
+    trigParam[kb] = dsp.getParam(path);
+    for (int i = 0; i < 3; i++) {
+      snprintf(path, sizeof(path), "/Wingie/%s/poly_note_%d", sides[kb], i);
+      polyNoteParam[kb][i] = dsp.getParam(path);
+    }
+    for (int i = 0; i < 9; i++) {
+      snprintf(path, sizeof(path), "/Wingie/%s/mute_%d", sides[kb], i);
+      muteParam[kb][i] = dsp.getParam(path);
+    }
+  }
 }
 
 void keyChange() {
+  keyChangedTime = esp_timer_get_time();
   keyChanged = 1;
 }
+
+// One command per line: "stats" prints the audio task timing, "stats reset" also starts it over,
+// "pots" the pot values and how many times each has changed
+void readSerial() {
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (serialLength < (int)sizeof(serialLine) - 1) serialLine[serialLength++] = c;
+      continue;
+    }
+    serialLine[serialLength] = 0;
+    serialLength = 0;
+    if (!strcmp(serialLine, "stats")) printStats(false);
+    else if (!strcmp(serialLine, "stats reset")) printStats(true);
+    else if (!strcmp(serialLine, "pots")) printPots();
+    else if (serialLine[0]) Serial.println("Commands: stats, stats reset, pots");
+  }
+}
+
+void printStats(bool reset) {
+  if (!dsp.getStats(stats, reset)) {
+    Serial.println("Stats : not ready");
+    return;
+  }
+  char buff[100];
+  snprintf(buff, sizeof(buff), "%u blocks of %.1f us, load %.1f %% (smoothed %.1f %%)",
+           (unsigned)stats.getBlocks(), stats.getPeriod(), stats.getLoad() * 100., dsp.getCPULoad() * 100.);
+  Serial.println(buff);
+  snprintf(buff, sizeof(buff), "xruns: %d overruns, %d underruns", dsp.getOverruns(), dsp.getUnderruns());
+  Serial.println(buff);
+  Serial.println("phase (us)       min     avg     p50     p99   p99.9     max");
+  for (int p = 0; p < audiostats::kPhases; p++) {
+    snprintf(buff, sizeof(buff), "%-10s  %7.1f %7.1f %7.1f %7.1f %7.1f %7.1f", audiostats::getName(p),
+             stats.getMin(p), stats.getMean(p), stats.getPercentile(p, 50), stats.getPercentile(p, 99),
+             stats.getPercentile(p, 99.9), stats.getMax(p));
+    Serial.println(buff);
+  }
+}
+
+void printPots() {
+  static const char* names[3] = {"mix", "decay", "volume"};
+  char buff[64];
+  snprintf(buff, sizeof(buff), "%u scans of %d readings", (unsigned)potSampler.getScans(), ADC_OVERSAMPLING);
+  Serial.println(buff);
+  for (int i = 0; i < 3; i++) {
+    snprintf(buff, sizeof(buff), "%-7s %5d, %u changes", names[i], pots[i].getValue(), (unsigned)pots[i].getChanges());
+    Serial.println(buff);
+  }
+}
@@ -0,0 +1,128 @@
+/************************************************************************
+ Wingie background ADC sampling
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef __adcsampler__
+#define __adcsampler__
+
+/*
+ Analog inputs read by a task of their own, every ADC_PERIOD_MS, rather than
+ by the control loop: each scan reads every pin ADC_OVERSAMPLING times in a
+ row and keeps the sum, which the loop picks up without waiting (getValue).
+ The sum is less noisy than a single reading, not finer: the filtering of
+ potinput still works in steps of the 12-bit ADC, scaled to ADC_FULL_SCALE.
+
+ The DMA mode of the ESP32 ADC goes through I2S0, which the audio codec
+ uses, hence a task. It runs on the core of the loop, at its priority (1),
+ and its readings take a few hundred microseconds per scan with the
+ defaults: that is most of a 32-frame block, so it stays under the split
+ channel worker of the audio task on that core (priority 2), which would
+ otherwise share the core with it in turns.
+ */
+
+#include <Arduino.h>
+#include <algorithm>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifndef ADC_MAX_PINS
+#define ADC_MAX_PINS 4
+#endif
+
+#ifndef ADC_OVERSAMPLING
+#define ADC_OVERSAMPLING 8
+#endif
+
+#ifndef ADC_PERIOD_MS
+#define ADC_PERIOD_MS 5
+#endif
+
+// Full scale of getValue
+#define ADC_FULL_SCALE (4095 * ADC_OVERSAMPLING)
+
+class adcsampler {
+
+    private:
+
+        int fPins[ADC_MAX_PINS];
+        int fNumPins;
+        std::atomic<uint32_t> fValues[ADC_MAX_PINS];
+        std::atomic<uint32_t> fScans;
+        std::atomic<bool> fRunning;
+        TaskHandle_t fHandle;
+
+        void scan()
+        {
+            for (int p = 0; p < fNumPins; p++) {
+                uint32_t sum = 0;
+                for (int i = 0; i < ADC_OVERSAMPLING; i++) {
+                    sum += analogRead(fPins[p]);
+                }
+                fValues[p].store(sum, std::memory_order_relaxed);
+            }
+            fScans++;
+        }
+
+        static void samplerTask(void* arg)
+        {
+            adcsampler* sampler = static_cast<adcsampler*>(arg);
+            TickType_t wake = xTaskGetTickCount();
+            TickType_t period = std::max<TickType_t>(1, ADC_PERIOD_MS / portTICK_PERIOD_MS);
+            while (sampler->fRunning) {
+                sampler->scan();
+                vTaskDelayUntil(&wake, period);
+            }
+            sampler->fHandle = nullptr;
+            vTaskDelete(nullptr);
+        }
+
+    public:
+
+        adcsampler(const int* pins, int count):fNumPins(std::min<int>(count, ADC_MAX_PINS)), fScans(0), fRunning(false), fHandle(nullptr)
+        {
+            for (int p = 0; p < ADC_MAX_PINS; p++) {
+                fPins[p] = (p < fNumPins) ? pins[p] : -1;
+                fValues[p] = 0;
+            }
+        }
+
+        // After a first scan, so that the values are there from the start
+        bool start(int priority = 1, int core = 1)
+        {
+            if (fRunning) return true;
+            scan();
+            fRunning = true;
+            if (xTaskCreatePinnedToCore(samplerTask, "ADC Sampler Task", 2048, (void*)this, priority, &fHandle, core) != pdPASS) {
+                fRunning = false;
+                return false;
+            }
+            return true;
+        }
+
+        // The task ends after its current scan
+        void stop() { fRunning = false; }
+
+        // Sum of the last ADC_OVERSAMPLING readings of pin 'index' (in the order given), up to ADC_FULL_SCALE
+        int getValue(int index) { return int(fValues[index].load(std::memory_order_relaxed)); }
+
+        // Scans since the start
+        uint32_t getScans() { return fScans; }
+
+};
+
+#endif
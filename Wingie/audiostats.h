@@ -0,0 +1,152 @@
+/************************************************************************
+ Wingie audio task timing statistics
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef __audiostats__
+#define __audiostats__
+
+/*
+ Timing of each phase of the audio task, block after block, in CPU cycles:
+ minimum, maximum, mean and a histogram to get percentiles from. The
+ histogram bins are fractions of the block period, so that they cover the
+ interesting range whatever the buffer size: AUDIOSTATS_BINS_PER_PERIOD bins
+ per period, up to AUDIOSTATS_PERIODS periods, the last bin taking all the
+ longer blocks.
+
+ Filled by the audio task only (add), read from a copy (see
+ esp32audio::getStats), so no member needs to be atomic.
+ */
+
+#include <stdint.h>
+#include <algorithm>
+
+#ifndef AUDIOSTATS_BINS_PER_PERIOD
+#define AUDIOSTATS_BINS_PER_PERIOD 32
+#endif
+
+#ifndef AUDIOSTATS_PERIODS
+#define AUDIOSTATS_PERIODS 2
+#endif
+
+#define AUDIOSTATS_BINS (AUDIOSTATS_BINS_PER_PERIOD * AUDIOSTATS_PERIODS)
+
+class audiostats {
+
+    public:
+
+        enum {
+            kReadWait,      // waiting for the input DMA, in i2s_read or for its event
+            kInput,         // I2S frames to float
+            kCompute,       // DSP, and control callbacks without I2S_EVENT_QUEUE
+            kOutput,        // float to I2S frames
+            kWriteWait,     // blocked in i2s_write
+            kBusy,          // from kInput to kOutput, what the load is made of
+            kPhases
+        };
+
+    private:
+
+        struct phase {
+            uint32_t fMin;
+            uint32_t fMax;
+            uint64_t fSum;
+            uint32_t fHistogram[AUDIOSTATS_BINS];
+        };
+
+        phase fPhases[kPhases];
+        uint32_t fBlocks;
+        uint32_t fPeriod;       // block period in cycles
+        float fCyclesPerUs;
+
+    public:
+
+        audiostats():fPeriod(1), fCyclesPerUs(1.f)
+        {
+            reset();
+        }
+
+        static const char* getName(int phase)
+        {
+            static const char* names[kPhases] = { "read wait", "input", "compute", "output", "write wait", "busy" };
+            return names[phase];
+        }
+
+        void reset()
+        {
+            for (int p = 0; p < kPhases; p++) {
+                fPhases[p].fMin = UINT32_MAX;
+                fPhases[p].fMax = 0;
+                fPhases[p].fSum = 0;
+                std::fill(fPhases[p].fHistogram, fPhases[p].fHistogram + AUDIOSTATS_BINS, 0);
+            }
+            fBlocks = 0;
+        }
+
+        // The block period (bsize / srate) and the CPU clock, before the first add
+        void setPeriod(uint32_t cycles, float cycles_per_us)
+        {
+            fPeriod = std::max<uint32_t>(1, cycles);
+            fCyclesPerUs = cycles_per_us;
+        }
+
+        inline void add(int p, uint32_t cycles)
+        {
+            phase& ph = fPhases[p];
+            ph.fMin = std::min<uint32_t>(ph.fMin, cycles);
+            ph.fMax = std::max<uint32_t>(ph.fMax, cycles);
+            ph.fSum += cycles;
+            uint64_t bin = (uint64_t(cycles) * AUDIOSTATS_BINS_PER_PERIOD) / fPeriod;
+            ph.fHistogram[std::min<uint64_t>(bin, AUDIOSTATS_BINS - 1)]++;
+        }
+
+        // To be called once all phases of a block are added
+        inline void endBlock() { fBlocks++; }
+
+        uint32_t getBlocks() { return fBlocks; }
+        float getPeriod() { return float(fPeriod) / fCyclesPerUs; }
+
+        // In microseconds, 0 before the first block
+        float getMin(int p) { return (fBlocks) ? float(fPhases[p].fMin) / fCyclesPerUs : 0.f; }
+        float getMax(int p) { return float(fPhases[p].fMax) / fCyclesPerUs; }
+        float getMean(int p) { return (fBlocks) ? float(double(fPhases[p].fSum) / fBlocks) / fCyclesPerUs : 0.f; }
+
+        /*
+         Time under which 'percent' % of the blocks are, in microseconds: the
+         upper edge of the histogram bin reaching that count, which gives a
+         resolution of one bin (1/AUDIOSTATS_BINS_PER_PERIOD of the period).
+         Never more than the maximum.
+        */
+        float getPercentile(int p, float percent)
+        {
+            if (fBlocks == 0) return 0.f;
+            uint64_t target = uint64_t(double(percent) * 0.01 * fBlocks + 0.5);
+            uint64_t count = 0;
+            int bin = 0;
+            for (; bin < AUDIOSTATS_BINS - 1; bin++) {
+                count += fPhases[p].fHistogram[bin];
+                if (count >= target) break;
+            }
+            uint64_t edge = (uint64_t(bin + 1) * fPeriod) / AUDIOSTATS_BINS_PER_PERIOD;
+            return float(std::min<uint64_t>(edge, fPhases[p].fMax)) / fCyclesPerUs;
+        }
+
+        // Mean proportion of the block period spent computing (between 0 and 1, more when late)
+        float getLoad() { return (fBlocks) ? float(double(fPhases[kBusy].fSum) / (double(fBlocks) * fPeriod)) : 0.f; }
+
+};
+
+#endif
@@ -0,0 +1,348 @@
+/************************************************************************
+ Wingie modal filter bank
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef __modalbank__
+#define __modalbank__
+
+/*
+ A bank of pm.modeFilter resonators sharing one input and one decay pole,
+ each with its own frequency and 'mute' envelope (en.asr attack/release).
+
+ State, coefficients and envelopes are stored as contiguous aligned arrays
+ (struct of arrays), so that one iteration of the inner loop updates
+ MODALBANK_VECTOR_SIZE modes at once: 8 with AVX, 4 with SSE, 1 otherwise.
+
+ The per-mode arithmetic is the same as the scalar code generated by Faust,
+ so every mode produces the same samples; only the order in which the modes
+ are summed changes.
+
+ Groups of MODALBANK_VECTOR_SIZE modes whose state has decayed under
+ MODALBANK_CULL_LEVEL while the input is silent are culled: their filters are
+ skipped until the input rises over MODALBANK_CULL_INPUT again. The input
+ threshold is much lower than the state one because a mode amplifies a
+ steady input at its frequency by up to 1 / (1 - pole).
+ */
+
+#ifndef MODALBANK_MAX_MODES
+#define MODALBANK_MAX_MODES 32
+#endif
+
+#ifndef MODALBANK_CULL_LEVEL
+#define MODALBANK_CULL_LEVEL 1e-7f
+#endif
+
+#ifndef MODALBANK_CULL_INPUT
+#define MODALBANK_CULL_INPUT 1e-11f
+#endif
+
+#ifndef RING_STATE
+#define RING_STATE 1
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define MODALBANK_VECTOR_SIZE 8
+#elif defined(__SSE__)
+    #include <xmmintrin.h>
+    #define MODALBANK_VECTOR_SIZE 4
+#else
+    #define MODALBANK_VECTOR_SIZE 1
+#endif
+
+#define MODALBANK_ALIGN 32
+
+static_assert(MODALBANK_MAX_MODES % 8 == 0, "MODALBANK_MAX_MODES must be a multiple of 8");
+
+/**
+ * Minimal vector abstraction used by the bank kernel.
+ */
+
+#if MODALBANK_VECTOR_SIZE == 8
+
+struct modalbank_vec {
+    __m256 v;
+    modalbank_vec() {}
+    modalbank_vec(__m256 x):v(x) {}
+    static modalbank_vec load(const float* p) { return _mm256_load_ps(p); }
+    static modalbank_vec set1(float x) { return _mm256_set1_ps(x); }
+    void store(float* p) const { _mm256_store_ps(p, v); }
+    friend modalbank_vec operator+(modalbank_vec a, modalbank_vec b) { return _mm256_add_ps(a.v, b.v); }
+    friend modalbank_vec operator-(modalbank_vec a, modalbank_vec b) { return _mm256_sub_ps(a.v, b.v); }
+    friend modalbank_vec operator*(modalbank_vec a, modalbank_vec b) { return _mm256_mul_ps(a.v, b.v); }
+    friend modalbank_vec vmin(modalbank_vec a, modalbank_vec b) { return _mm256_min_ps(a.v, b.v); }
+    friend modalbank_vec vmax(modalbank_vec a, modalbank_vec b) { return _mm256_max_ps(a.v, b.v); }
+    float sum() const
+    {
+        alignas(MODALBANK_ALIGN) float lanes[8];
+        _mm256_store_ps(lanes, v);
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+};
+
+#elif MODALBANK_VECTOR_SIZE == 4
+
+struct modalbank_vec {
+    __m128 v;
+    modalbank_vec() {}
+    modalbank_vec(__m128 x):v(x) {}
+    static modalbank_vec load(const float* p) { return _mm_load_ps(p); }
+    static modalbank_vec set1(float x) { return _mm_set1_ps(x); }
+    void store(float* p) const { _mm_store_ps(p, v); }
+    friend modalbank_vec operator+(modalbank_vec a, modalbank_vec b) { return _mm_add_ps(a.v, b.v); }
+    friend modalbank_vec operator-(modalbank_vec a, modalbank_vec b) { return _mm_sub_ps(a.v, b.v); }
+    friend modalbank_vec operator*(modalbank_vec a, modalbank_vec b) { return _mm_mul_ps(a.v, b.v); }
+    friend modalbank_vec vmin(modalbank_vec a, modalbank_vec b) { return _mm_min_ps(a.v, b.v); }
+    friend modalbank_vec vmax(modalbank_vec a, modalbank_vec b) { return _mm_max_ps(a.v, b.v); }
+    float sum() const
+    {
+        alignas(MODALBANK_ALIGN) float lanes[4];
+        _mm_store_ps(lanes, v);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+};
+
+#else
+
+// Scalar fallback (ESP32 Xtensa LX6 has no SIMD unit usable from C)
+struct modalbank_vec {
+    float v;
+    modalbank_vec() {}
+    modalbank_vec(float x):v(x) {}
+    static modalbank_vec load(const float* p) { return *p; }
+    static modalbank_vec set1(float x) { return x; }
+    void store(float* p) const { *p = v; }
+    friend modalbank_vec operator+(modalbank_vec a, modalbank_vec b) { return a.v + b.v; }
+    friend modalbank_vec operator-(modalbank_vec a, modalbank_vec b) { return a.v - b.v; }
+    friend modalbank_vec operator*(modalbank_vec a, modalbank_vec b) { return a.v * b.v; }
+    friend modalbank_vec vmin(modalbank_vec a, modalbank_vec b) { return std::min<float>(a.v, b.v); }
+    friend modalbank_vec vmax(modalbank_vec a, modalbank_vec b) { return std::max<float>(a.v, b.v); }
+    float sum() const { return v; }
+};
+
+#endif
+
+class modalbank {
+
+    private:
+
+        alignas(MODALBANK_ALIGN) float fCos[MODALBANK_MAX_MODES];          // cos(2*pi*freq/SR) of each mode
+        alignas(MODALBANK_ALIGN) float fState[2][MODALBANK_MAX_MODES];     // y(n-1) in fState[fCurrent], y(n-2) in the other
+        alignas(MODALBANK_ALIGN) float fMuteButton[MODALBANK_MAX_MODES];   // 'mute_N' button value (0 or 1)
+        alignas(MODALBANK_ALIGN) float fMuteReleased[MODALBANK_MAX_MODES]; // 1 when the button is released
+        alignas(MODALBANK_ALIGN) float fMuteAttack[MODALBANK_MAX_MODES];   // samples since the button was pressed
+        alignas(MODALBANK_ALIGN) float fMuteRelease[MODALBANK_MAX_MODES];  // samples since the button was released
+
+        int fIdle[MODALBANK_MAX_MODES / MODALBANK_VECTOR_SIZE];   // samples skipped by each culled group, -1 when running
+
+        float fMuteRate;    // 1 / (attack or release time in samples)
+        float fInput;       // last input sample
+        int fNumModes;
+        int fNumLanes;      // fNumModes rounded up to MODALBANK_VECTOR_SIZE
+        int fNumIdle;       // number of culled groups
+        int fCurrent;       // with RING_STATE, flips every sample so that y(n) overwrites y(n-2)
+
+        void resetLane(int lane)
+        {
+            fState[0][lane] = 0.0f;
+            fState[1][lane] = 0.0f;
+            fMuteButton[lane] = 0.0f;
+            fMuteReleased[lane] = 1.0f;
+            fMuteAttack[lane] = 0.0f;
+            fMuteRelease[lane] = 0.0f;
+        }
+
+        // Unused lanes are kept fully muted, so that they add nothing to the output
+        void parkLane(int lane)
+        {
+            fCos[lane] = 0.0f;
+            fState[0][lane] = 0.0f;
+            fState[1][lane] = 0.0f;
+            fMuteButton[lane] = 1.0f;
+            fMuteReleased[lane] = 0.0f;
+            fMuteAttack[lane] = 1.0f / fMuteRate;
+            fMuteRelease[lane] = 0.0f;
+        }
+
+        // Bring the mute envelope counters of a culled group up to date
+        void settle(int group)
+        {
+            float skipped = float(fIdle[group]);
+            for (int m = group * MODALBANK_VECTOR_SIZE; m < (group + 1) * MODALBANK_VECTOR_SIZE; m++) {
+                fMuteAttack[m] += fMuteButton[m] * skipped;
+                fMuteRelease[m] = fMuteReleased[m] * (fMuteRelease[m] + skipped);
+            }
+            fIdle[group] = 0;
+        }
+
+        void wake(int group)
+        {
+            settle(group);
+            fIdle[group] = -1;
+            fNumIdle--;
+        }
+
+        void wakeAll()
+        {
+            for (int g = 0; g < MODALBANK_MAX_MODES / MODALBANK_VECTOR_SIZE; g++) {
+                if (fIdle[g] >= 0) wake(g);
+            }
+        }
+
+    public:
+
+        modalbank():fMuteRate(1.0f), fInput(0.0f), fNumModes(0), fNumLanes(0), fNumIdle(0), fCurrent(0)
+        {
+            std::fill(fIdle, fIdle + MODALBANK_MAX_MODES / MODALBANK_VECTOR_SIZE, -1);
+            for (int m = 0; m < MODALBANK_MAX_MODES; m++) {
+                parkLane(m);
+            }
+        }
+
+        /* Set the mute envelope slope: 1 / max(1, time * SR) */
+        void setMuteRate(float rate)
+        {
+            fMuteRate = rate;
+            setNumModes(fNumModes);
+        }
+
+        /**
+         * Change the number of running modes, can be called between two blocks.
+         * Added modes start silent and unmuted, removed modes are dropped
+         * immediately, so the caller should remove the least audible ones (the highest).
+         */
+        void setNumModes(int modes)
+        {
+            modes = std::max<int>(0, std::min<int>(modes, MODALBANK_MAX_MODES));
+            wakeAll();
+            for (int m = fNumModes; m < modes; m++) {
+                resetLane(m);
+            }
+            for (int m = modes; m < MODALBANK_MAX_MODES; m++) {
+                parkLane(m);
+            }
+            fNumModes = modes;
+            fNumLanes = ((fNumModes + MODALBANK_VECTOR_SIZE - 1) / MODALBANK_VECTOR_SIZE) * MODALBANK_VECTOR_SIZE;
+        }
+        int getNumModes() { return fNumModes; }
+
+        void clear()
+        {
+            wakeAll();
+            for (int m = 0; m < fNumModes; m++) {
+                resetLane(m);
+            }
+            fInput = 0.0f;
+        }
+
+        /* Set the mode frequency as cos(2*pi*freq/SR) */
+        void setCos(int mode, float c)
+        {
+            if (mode < fNumModes) fCos[mode] = c;
+        }
+
+        /* To be called once per block with the current 'mute_N' button value */
+        void setMute(int mode, float button)
+        {
+            if (mode >= fNumModes) return;
+            int group = mode / MODALBANK_VECTOR_SIZE;
+            if (fIdle[group] > 0) settle(group);
+            fMuteAttack[mode] *= float(fMuteButton[mode] >= button);
+            fMuteButton[mode] = button;
+            fMuteReleased[mode] = float(button == 0.0f);
+        }
+
+        /**
+         * Compute one sample of the bank.
+         *
+         * @param x - the input sample
+         * @param a - the '-2 * pole' coefficient
+         * @param b - the 'pole * pole' coefficient
+         *
+         * @return the sum of all modes, each weighted by its mute envelope
+         */
+        inline float tick(float x, float a, float b)
+        {
+            if (fNumIdle > 0 && std::fabs(x) >= MODALBANK_CULL_INPUT) wakeAll();
+            fInput = x;
+            const modalbank_vec vx = modalbank_vec::set1(x);
+            const modalbank_vec va = modalbank_vec::set1(a);
+            const modalbank_vec vb = modalbank_vec::set1(b);
+            const modalbank_vec vrate = modalbank_vec::set1(fMuteRate);
+            const modalbank_vec zero = modalbank_vec::set1(0.0f);
+            const modalbank_vec one = modalbank_vec::set1(1.0f);
+            float* state1 = fState[fCurrent];
+            float* state2 = fState[fCurrent ^ 1];
+            modalbank_vec acc = zero;
+            for (int g = 0, m = 0; m < fNumLanes; g++, m += MODALBANK_VECTOR_SIZE) {
+                if (fIdle[g] >= 0) {
+                    fIdle[g]++;
+                    continue;
+                }
+                modalbank_vec s1 = modalbank_vec::load(&state1[m]);
+                modalbank_vec s2 = modalbank_vec::load(&state2[m]);
+                modalbank_vec y = vx - (((va * s1) * modalbank_vec::load(&fCos[m])) + (vb * s2));
+                modalbank_vec attack = modalbank_vec::load(&fMuteButton[m]) + modalbank_vec::load(&fMuteAttack[m]);
+                modalbank_vec release = modalbank_vec::load(&fMuteReleased[m]) * (modalbank_vec::load(&fMuteRelease[m]) + one);
+                modalbank_vec env = one - vmax(zero, vmin(vrate * attack, one) - (vrate * release));
+                acc = acc + ((y - s2) * (env * env));
+                attack.store(&fMuteAttack[m]);
+                release.store(&fMuteRelease[m]);
+#if RING_STATE
+                y.store(&state2[m]);
+#else
+                s1.store(&state2[m]);
+                y.store(&state1[m]);
+#endif
+            }
+#if RING_STATE
+            fCurrent ^= 1;
+#endif
+            return acc.sum();
+        }
+
+        /**
+         * Cull the groups that have decayed to silence, to be called between two blocks.
+         * Their state is set to zero, so the error is bounded by MODALBANK_CULL_LEVEL.
+         */
+        void cull()
+        {
+            if (std::fabs(fInput) >= MODALBANK_CULL_INPUT) return;
+            for (int g = 0, m = 0; m < fNumLanes; g++, m += MODALBANK_VECTOR_SIZE) {
+                if (fIdle[g] >= 0) continue;
+                bool silent = true;
+                for (int l = m; l < m + MODALBANK_VECTOR_SIZE; l++) {
+                    silent &= (std::fabs(fState[0][l]) < MODALBANK_CULL_LEVEL) && (std::fabs(fState[1][l]) < MODALBANK_CULL_LEVEL);
+                }
+                if (silent) {
+                    std::fill(fState[0] + m, fState[0] + m + MODALBANK_VECTOR_SIZE, 0.0f);
+                    std::fill(fState[1] + m, fState[1] + m + MODALBANK_VECTOR_SIZE, 0.0f);
+                    fIdle[g] = 0;
+                    fNumIdle++;
+                }
+            }
+        }
+
+        /* Number of modes currently culled */
+        int getNumCulled() { return fNumIdle * MODALBANK_VECTOR_SIZE; }
+
+};
+
+#endif
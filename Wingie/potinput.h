@@ -0,0 +1,95 @@
+/************************************************************************
+ Wingie front panel pot filtering
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef __potinput__
+#define __potinput__
+
+/*
+ A pot read with the ADC, filtered so that its value only changes when the
+ pot is turned: the readings are averaged (one pole, POT_SMOOTHING of the
+ distance covered per reading), then the published value follows the
+ average with a deadband of POT_DEADBAND steps of the 12-bit ADC, which the
+ noise of the ESP32 ADC stays in. For the summed readings of adcsampler, the
+ deadband is scaled to their full scale: the pots keep the 12-bit steps, the
+ sum only lowers the noise the deadband has to cover. Both ends of the range are always reached. update
+ tells whether the published value changed, for the caller to send the
+ new parameter only then, and the changes are counted.
+ */
+
+#include <stdint.h>
+
+#ifndef POT_SMOOTHING
+#define POT_SMOOTHING 0.25f
+#endif
+
+#ifndef POT_DEADBAND
+#define POT_DEADBAND 12
+#endif
+
+class potinput {
+
+    private:
+
+        int fMax;           // full scale reading
+        int fDeadband;
+        float fAverage;
+        int fValue;         // published, -1 before the first reading
+        uint32_t fChanges;
+
+    public:
+
+        potinput(int max = 4095):fMax(max), fDeadband(int((int64_t(POT_DEADBAND) * max) / 4095)), fAverage(0.f), fValue(-1), fChanges(0) {}
+
+        // With a new ADC reading, true if the value changed (always on the first reading)
+        bool update(int reading)
+        {
+            if (fValue < 0) {
+                fAverage = float(reading);
+            } else {
+                fAverage += POT_SMOOTHING * (float(reading) - fAverage);
+            }
+            int average = int(fAverage + 0.5f);
+            int value = average;
+            if (average < fDeadband) {
+                value = 0;
+            } else if (average > fMax - fDeadband) {
+                value = fMax;
+            }
+            if (value == fValue) return false;
+            // An end is published as soon as the average is within a deadband of it, and left
+            // once the average is a deadband past that, so that the noise does not flip it
+            if (fValue >= 0 && value != 0 && value != fMax) {
+                int from = (fValue == 0) ? fDeadband : (fValue == fMax) ? fMax - fDeadband : fValue;
+                if (average > from - fDeadband && average < from + fDeadband) return false;
+            }
+            fValue = value;
+            fChanges++;
+            return true;
+        }
+
+        // Between 0 and the full scale reading
+        int getValue() { return (fValue < 0) ? 0 : fValue; }
+        // Between 0 and 1
+        float getPosition() { return float(getValue()) / float(fMax); }
+
+        // Value changes since the start, the first reading included
+        uint32_t getChanges() { return fChanges; }
+
+};
+
+#endif
@@ -0,0 +1,198 @@
+/************************************************************************
+ Wingie fixed-point modal filter bank
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef __q31bank__
+#define __q31bank__
+
+/*
+ Integer arithmetic for the fixed-point engine of mydsp (FIXED_POINT).
+
+ Audio in and out of the engine is Q31, as read from and written to I2S.
+ Inside, signals are Q24 (s7.24) to leave 7 bits of headroom: the resonators
+ have a large gain at their frequency and the float graph lets their state go
+ well over 1. Gains and filter coefficients are Q24 too, except the resonator
+ pole and frequency, which need the precision of Q31.
+ The state of the resonators has more headroom still (Q31BANK_HEADROOM).
+ Products are computed on 64 bits and saturated back to 32 bits.
+ */
+
+#include <stdint.h>
+#include <algorithm>
+
+#ifndef MODALBANK_MAX_MODES
+#define MODALBANK_MAX_MODES 32
+#endif
+
+/*
+ Extra headroom of the resonator state over the Q24 signals, in bits. The
+ low modes with a long decay reach several hundred times the input level
+ (about 800 at 65 Hz with a 5 s decay on a loud input), the default of 4
+ makes the state Q20, up to +/-2048. More headroom costs precision: the
+ truncation noise of the state is amplified by the resonance (about 12 dB
+ more error per 2 bits in tools/compare_q31.cpp).
+*/
+#ifndef Q31BANK_HEADROOM
+#define Q31BANK_HEADROOM 4
+#endif
+
+#define Q24_ONE (int32_t(1) << 24)
+#define Q31_ONE int32_t(0x7fffffff)
+
+static inline int32_t q_sat(int64_t x)
+{
+    return int32_t(std::max<int64_t>(INT32_MIN, std::min<int64_t>(INT32_MAX, x)));
+}
+
+// Q24 * Q24 -> Q24 (or Q31 * Q24 -> Q31)
+static inline int32_t q24_mul(int32_t a, int32_t b)
+{
+    return q_sat((int64_t(a) * b) >> 24);
+}
+
+// Q31 * Q31 -> Q31 (or Q24 * Q31 -> Q24)
+static inline int32_t q31_mul(int32_t a, int32_t b)
+{
+    return q_sat((int64_t(a) * b) >> 31);
+}
+
+// Conversions, for control rate values only
+static inline int32_t q24_from_float(float x)
+{
+    return q_sat(int64_t(x * 16777216.0f));
+}
+
+static inline int32_t q31_from_float(float x)
+{
+    return q_sat(int64_t(double(x) * 2147483648.0));
+}
+
+static inline float q24_to_float(int32_t x)
+{
+    return float(x) * 5.96046448e-08f;
+}
+
+/**
+ * Fixed-point version of modalbank, same modes, mute envelopes and API.
+ * State is Q(24 - Q31BANK_HEADROOM), mode frequencies cos(2*pi*freq/SR) are Q31, and the mute
+ * envelope counters are integers capped at the length of the ramps.
+ */
+
+class q31modalbank {
+
+    private:
+
+        int32_t fCos[MODALBANK_MAX_MODES];          // Q31
+        int32_t fState1[MODALBANK_MAX_MODES];       // y(n-1)
+        int32_t fState2[MODALBANK_MAX_MODES];       // y(n-2)
+        int32_t fMuteButton[MODALBANK_MAX_MODES];   // 0 or 1
+        int32_t fMuteReleased[MODALBANK_MAX_MODES]; // 1 when the button is released
+        int32_t fMuteAttack[MODALBANK_MAX_MODES];   // samples since the button was pressed
+        int32_t fMuteRelease[MODALBANK_MAX_MODES];  // samples since the button was released
+
+        int32_t fMuteRate;  // Q31
+        int32_t fMuteLimit; // ramp length in samples, where the counters stop
+        int fNumModes;
+
+    public:
+
+        q31modalbank():fMuteRate(Q31_ONE), fMuteLimit(1), fNumModes(0)
+        {
+            std::fill(fCos, fCos + MODALBANK_MAX_MODES, 0);
+            std::fill(fMuteButton, fMuteButton + MODALBANK_MAX_MODES, 0);
+            clear();
+        }
+
+        /* Set the mute envelope slope: 1 / max(1, time * SR) */
+        void setMuteRate(float rate)
+        {
+            fMuteRate = q31_from_float(rate);
+            fMuteLimit = int32_t(1.0f / rate) + 1;
+        }
+
+        void setNumModes(int modes)
+        {
+            modes = std::max<int>(0, std::min<int>(modes, MODALBANK_MAX_MODES));
+            for (int m = fNumModes; m < modes; m++) {
+                fState1[m] = fState2[m] = 0;
+                fMuteButton[m] = fMuteAttack[m] = fMuteRelease[m] = 0;
+                fMuteReleased[m] = 1;
+            }
+            fNumModes = modes;
+        }
+        int getNumModes() { return fNumModes; }
+
+        void clear()
+        {
+            std::fill(fState1, fState1 + MODALBANK_MAX_MODES, 0);
+            std::fill(fState2, fState2 + MODALBANK_MAX_MODES, 0);
+            std::fill(fMuteReleased, fMuteReleased + MODALBANK_MAX_MODES, 1);
+            std::fill(fMuteAttack, fMuteAttack + MODALBANK_MAX_MODES, 0);
+            std::fill(fMuteRelease, fMuteRelease + MODALBANK_MAX_MODES, 0);
+        }
+
+        /* Set the mode frequency as cos(2*pi*freq/SR) */
+        void setCos(int mode, float c)
+        {
+            if (mode < fNumModes) fCos[mode] = q31_from_float(c);
+        }
+
+        /* To be called once per block with the current 'mute_N' button value */
+        void setMute(int mode, float button)
+        {
+            if (mode >= fNumModes) return;
+            int32_t pressed = (button != 0.0f);
+            fMuteAttack[mode] *= (fMuteButton[mode] >= pressed);
+            fMuteButton[mode] = pressed;
+            fMuteReleased[mode] = !pressed;
+        }
+
+        /**
+         * Compute one sample of the bank.
+         *
+         * @param x - the input sample (Q24)
+         * @param r - the pole radius (Q31)
+         * @param b - the 'pole * pole' coefficient (Q31)
+         *
+         * @return the sum of all modes, each weighted by its mute envelope (Q24)
+         */
+        inline int32_t tick(int32_t x, int32_t r, int32_t b)
+        {
+            int64_t acc = 0;
+            x >>= Q31BANK_HEADROOM;
+            for (int m = 0; m < fNumModes; m++) {
+                int32_t s1 = fState1[m];
+                int32_t s2 = fState2[m];
+                // y = x - (-2 * r * s1 * cos + r * r * s2), 2 * r * s1 is r (Q31) * s1 >> 30
+                int32_t rs1 = q_sat((int64_t(r) * s1) >> 30);
+                int32_t y = q_sat(int64_t(x) + q31_mul(rs1, fCos[m]) - q31_mul(b, s2));
+                int32_t attack = std::min<int32_t>(fMuteAttack[m] + fMuteButton[m], fMuteLimit);
+                int32_t release = fMuteReleased[m] * std::min<int32_t>(fMuteRelease[m] + 1, fMuteLimit);
+                int64_t ramp = std::min<int64_t>(int64_t(fMuteRate) * attack, Q31_ONE) - int64_t(fMuteRate) * release;
+                int32_t env = Q31_ONE - int32_t(std::max<int64_t>(0, ramp));
+                acc += ((int64_t(y) - s2) * q31_mul(env, env)) >> 31;
+                fMuteAttack[m] = attack;
+                fMuteRelease[m] = release;
+                fState2[m] = s1;
+                fState1[m] = y;
+            }
+            return q_sat(acc << Q31BANK_HEADROOM);
+        }
+
+};
+
+#endif
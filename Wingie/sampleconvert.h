@@ -0,0 +1,251 @@
+/************************************************************************
+ Wingie sample format converters
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+#ifndef __sampleconvert__
+#define __sampleconvert__
+
+/*
+ Conversions between interleaved stereo I2S frames and the planar float
+ buffers of the DSP, for three frame formats:
+
+ - s32: int32_t samples, full scale 2^31
+ - s24: int32_t containers holding sign extended 24-bit samples, full scale 2^23
+ - s16: int16_t samples, full scale 2^15
+
+ Integer to float is exact (a multiplication by a power of two). Float to
+ integer multiplies by the full scale, saturates to the integer range and
+ truncates toward zero, like the cast of the previous clip() macro, but
+ without its overflow at +1.0. NaN gives the positive full scale.
+
+ With SSE2 (SAMPLECONVERT_SIMD, on by default) four frames are converted per
+ iteration. On the ESP32, the FPU instructions float.s and trunc.s scale by
+ 2^15 as part of the conversion, the wider formats adding an exact
+ multiplication by a power of two. The scalar and SSE2 implementations give
+ the same result bit for bit, see tools/bench_convert.cpp, which runs on the
+ host and does not exercise the ESP32 one.
+
+ A null 'right' channel reads only the left samples of the frames (mono DSP
+ input), or writes the left channel to both sides of the frames (mono DSP
+ output).
+ */
+
+#include <stdint.h>
+#include <algorithm>
+
+#ifndef SAMPLECONVERT_SIMD
+#define SAMPLECONVERT_SIMD 1
+#endif
+
+#if SAMPLECONVERT_SIMD && defined(__SSE2__)
+    #include <emmintrin.h>
+    #define SAMPLECONVERT_SSE2 1
+#else
+    #define SAMPLECONVERT_SSE2 0
+#endif
+
+#if defined(__XTENSA__) && defined(__XTENSA_HARD_FLOAT__)
+    #define SAMPLECONVERT_XTENSA 1
+#else
+    #define SAMPLECONVERT_XTENSA 0
+#endif
+
+/**
+ * One sample, BITS being the full scale width (32, 24 or 16).
+ */
+
+template <int BITS>
+static inline float sampleconvert_to_float(int32_t x)
+{
+#if SAMPLECONVERT_XTENSA
+    // The scale of float.s is at most 15, the rest is an exact multiplication by a power of two
+    float f;
+    __asm__("float.s %0, %1, 15" : "=f"(f) : "a"(x));
+    return (BITS == 16) ? f : f * (1.0f / float(uint32_t(1) << (BITS - 16)));
+#else
+    return float(x) * (1.0f / float(uint32_t(1) << (BITS - 1)));
+#endif
+}
+
+template <int BITS>
+static inline int32_t sampleconvert_from_float(float x)
+{
+    const int32_t top = int32_t((uint32_t(1) << (BITS - 1)) - 1);
+#if SAMPLECONVERT_XTENSA
+    // Same scale limit for trunc.s, which saturates to the int32 range by itself
+    if (BITS > 16) x *= float(uint32_t(1) << (BITS - 16));
+    int32_t i;
+    __asm__("trunc.s %0, %1, 15" : "=a"(i) : "f"(x));
+    return (BITS == 32) ? i : std::max<int32_t>(-top - 1, std::min<int32_t>(top, i));
+#else
+    const float scale = float(uint32_t(1) << (BITS - 1));
+    // 2^31 does not fit in an int32, it is the one value handled apart for s32
+    const float high = (BITS == 32) ? scale : float(top);
+    float v = std::max<float>(-scale, std::min<float>(high, x * scale));
+    return (BITS == 32 && v >= scale) ? top : int32_t(v);
+#endif
+}
+
+#if SAMPLECONVERT_SSE2
+
+// 4 frames from 8 int32 samples, BITS wide
+template <int BITS>
+static inline void sampleconvert_deinterleave4(__m128i a, __m128i b, __m128& left, __m128& right)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / float(uint32_t(1) << (BITS - 1)));
+    __m128 fa = _mm_mul_ps(_mm_cvtepi32_ps(a), scale);
+    __m128 fb = _mm_mul_ps(_mm_cvtepi32_ps(b), scale);
+    left = _mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0));
+    right = _mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+// 4 samples to saturated int32, BITS wide
+template <int BITS>
+static inline __m128i sampleconvert_from_float4(__m128 x)
+{
+    const float scale = float(uint32_t(1) << (BITS - 1));
+    const float high = (BITS == 32) ? scale : float((uint32_t(1) << (BITS - 1)) - 1);
+    x = _mm_mul_ps(x, _mm_set1_ps(scale));
+    // min/max return their second operand on NaN, the high bound like std::min above
+    x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(high)), _mm_set1_ps(-scale));
+    __m128i i = _mm_cvttps_epi32(x);
+    if (BITS == 32) {
+        // cvttps gives 0x80000000 for 2^31, flipped to 0x7fffffff
+        i = _mm_xor_si128(i, _mm_castps_si128(_mm_cmpge_ps(x, _mm_set1_ps(scale))));
+    }
+    return i;
+}
+
+#endif
+
+/**
+ * Frames with int32 containers (s32 and s24) to planar float, and back.
+ */
+
+template <int BITS>
+static inline void sampleconvert_int32_to_planar(const int32_t* frames, float* left, float* right, int count)
+{
+    int i = 0;
+    if (right) {
+    #if SAMPLECONVERT_SSE2
+        for (; i + 4 <= count; i += 4) {
+            __m128 l, r;
+            sampleconvert_deinterleave4<BITS>(_mm_loadu_si128((const __m128i*)&frames[2 * i]), _mm_loadu_si128((const __m128i*)&frames[2 * i + 4]), l, r);
+            _mm_storeu_ps(&left[i], l);
+            _mm_storeu_ps(&right[i], r);
+        }
+    #endif
+        for (; i < count; i++) {
+            left[i] = sampleconvert_to_float<BITS>(frames[2 * i]);
+            right[i] = sampleconvert_to_float<BITS>(frames[2 * i + 1]);
+        }
+    } else {
+        for (; i < count; i++) {
+            left[i] = sampleconvert_to_float<BITS>(frames[2 * i]);
+        }
+    }
+}
+
+template <int BITS>
+static inline void sampleconvert_planar_to_int32(const float* left, const float* right, int32_t* frames, int count)
+{
+    if (!right) right = left;
+    int i = 0;
+#if SAMPLECONVERT_SSE2
+    for (; i + 4 <= count; i += 4) {
+        __m128i l = sampleconvert_from_float4<BITS>(_mm_loadu_ps(&left[i]));
+        __m128i r = sampleconvert_from_float4<BITS>(_mm_loadu_ps(&right[i]));
+        _mm_storeu_si128((__m128i*)&frames[2 * i], _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128((__m128i*)&frames[2 * i + 4], _mm_unpackhi_epi32(l, r));
+    }
+#endif
+    for (; i < count; i++) {
+        frames[2 * i] = sampleconvert_from_float<BITS>(left[i]);
+        frames[2 * i + 1] = sampleconvert_from_float<BITS>(right[i]);
+    }
+}
+
+static inline void sampleconvert_s32_to_planar(const int32_t* frames, float* left, float* right, int count)
+{
+    sampleconvert_int32_to_planar<32>(frames, left, right, count);
+}
+
+static inline void sampleconvert_planar_to_s32(const float* left, const float* right, int32_t* frames, int count)
+{
+    sampleconvert_planar_to_int32<32>(left, right, frames, count);
+}
+
+static inline void sampleconvert_s24_to_planar(const int32_t* frames, float* left, float* right, int count)
+{
+    sampleconvert_int32_to_planar<24>(frames, left, right, count);
+}
+
+static inline void sampleconvert_planar_to_s24(const float* left, const float* right, int32_t* frames, int count)
+{
+    sampleconvert_planar_to_int32<24>(left, right, frames, count);
+}
+
+/**
+ * Frames of int16 samples (s16) to planar float, and back.
+ */
+
+static inline void sampleconvert_s16_to_planar(const int16_t* frames, float* left, float* right, int count)
+{
+    int i = 0;
+    if (right) {
+    #if SAMPLECONVERT_SSE2
+        for (; i + 4 <= count; i += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i*)&frames[2 * i]);
+            // Sign extension of the 8 samples to int32
+            __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+            __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+            __m128 l, r;
+            sampleconvert_deinterleave4<16>(a, b, l, r);
+            _mm_storeu_ps(&left[i], l);
+            _mm_storeu_ps(&right[i], r);
+        }
+    #endif
+        for (; i < count; i++) {
+            left[i] = sampleconvert_to_float<16>(frames[2 * i]);
+            right[i] = sampleconvert_to_float<16>(frames[2 * i + 1]);
+        }
+    } else {
+        for (; i < count; i++) {
+            left[i] = sampleconvert_to_float<16>(frames[2 * i]);
+        }
+    }
+}
+
+static inline void sampleconvert_planar_to_s16(const float* left, const float* right, int16_t* frames, int count)
+{
+    if (!right) right = left;
+    int i = 0;
+#if SAMPLECONVERT_SSE2
+    for (; i + 4 <= count; i += 4) {
+        __m128i l = sampleconvert_from_float4<16>(_mm_loadu_ps(&left[i]));
+        __m128i r = sampleconvert_from_float4<16>(_mm_loadu_ps(&right[i]));
+        // Already in the int16 range, the saturation of packs is a no-op
+        _mm_storeu_si128((__m128i*)&frames[2 * i], _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+    }
+#endif
+    for (; i < count; i++) {
+        frames[2 * i] = int16_t(sampleconvert_from_float<16>(left[i]));
+        frames[2 * i + 1] = int16_t(sampleconvert_from_float<16>(right[i]));
+    }
+}
+
+#endif
@@ -0,0 +1,199 @@
+/************************************************************************
+ Wingie sample format converters check and benchmark
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/*
+ Checks the converters of sampleconvert.h against a reference computed in
+ double, for the s32, s24 and s16 formats, stereo and mono, on random and
+ edge values (full scale, out of range, infinities, NaN) and on every block
+ size from 1 to 40 frames, so that both the SIMD body and the scalar tail
+ run. Then times them against the per-sample loops that esp32audio used
+ before, on 32-frame blocks.
+
+ Build (from this directory):
+
+    c++ -O2 -std=c++11 -I../Wingie -o bench_convert bench_convert.cpp
+
+ Add -DSAMPLECONVERT_SIMD=0 to check and time the scalar version. Returns 1
+ if any conversion differs from the reference.
+*/
+
+#include "sampleconvert.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#define BENCH_BUFFER_SIZE 32
+#define BENCH_BLOCKS 200000
+
+static uint32_t gSeed = 1;
+
+static uint32_t bench_random()
+{
+    gSeed = gSeed * 1664525u + 1013904223u;
+    return gSeed;
+}
+
+static int32_t reference_from_float(float x, int bits)
+{
+    double scale = double(uint32_t(1) << (bits - 1));
+    double top = scale - 1.;
+    double v = double(x) * scale;
+    if (std::isnan(v) || v >= top) return int32_t(top);
+    if (v <= -scale) return int32_t(-scale);
+    return int32_t(v);
+}
+
+static bool same_float(float a, float b)
+{
+    return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// Integer samples of the format: random, full scale, zero and +/- 1
+static int32_t test_sample(int bits, int k)
+{
+    int32_t top = int32_t((uint32_t(1) << (bits - 1)) - 1);
+    switch (k % 8) {
+        case 0: return top;
+        case 1: return -top - 1;
+        case 2: return 0;
+        case 3: return ((k & 8) ? 1 : -1);
+        default: return int32_t(bench_random()) >> (32 - bits);
+    }
+}
+
+// Float samples: in and out of range, edges of the scale, special values
+static float test_float(int k)
+{
+    const float specials[] = {
+        1.f, -1.f, 0.f, -0.f, 0.99999994f, 1.00000012f, -1.00000012f, 0.5f,
+        1e30f, -1e30f, 1e-40f, std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN()
+    };
+    const int num = sizeof(specials) / sizeof(float);
+    if (k % 3 == 0) return specials[(k / 3) % num];
+    return (float(int32_t(bench_random())) * 4.65661287e-10f) * 1.5f;
+}
+
+template <typename T, int BITS>
+static int check_format(const char* name,
+                        void (*to_planar)(const T*, float*, float*, int),
+                        void (*from_planar)(const float*, const float*, T*, int))
+{
+    int errors = 0;
+    const double scale = double(uint32_t(1) << (BITS - 1));
+    for (int count = 1; count <= 40; count++) {
+        for (int mono = 0; mono < 2; mono++) {
+            std::vector<T> frames(2 * count), out(2 * count);
+            std::vector<float> left(count), right(count), fleft(count), fright(count);
+            for (int i = 0; i < 2 * count; i++) {
+                frames[i] = T(test_sample(BITS, i + count));
+            }
+            for (int i = 0; i < count; i++) {
+                fleft[i] = test_float(2 * i + count);
+                fright[i] = test_float(2 * i + 1 + count);
+            }
+            to_planar(frames.data(), left.data(), (mono) ? nullptr : right.data(), count);
+            from_planar(fleft.data(), (mono) ? nullptr : fright.data(), out.data(), count);
+            for (int i = 0; i < count; i++) {
+                if (!same_float(left[i], float(double(frames[2 * i]) / scale))
+                    || (!mono && !same_float(right[i], float(double(frames[2 * i + 1]) / scale)))) {
+                    printf("%s to float, %d frames, frame %d: %d %d -> %.9g %.9g\n", name, count, i, int(frames[2 * i]), int(frames[2 * i + 1]), left[i], right[i]);
+                    errors++;
+                }
+                int32_t l = reference_from_float(fleft[i], BITS);
+                int32_t r = reference_from_float((mono) ? fleft[i] : fright[i], BITS);
+                if (int32_t(out[2 * i]) != l || int32_t(out[2 * i + 1]) != r) {
+                    printf("%s from float, %d frames, frame %d: %.9g %.9g -> %d %d, expected %d %d\n", name, count, i, fleft[i], fright[i], int(out[2 * i]), int(out[2 * i + 1]), l, r);
+                    errors++;
+                }
+            }
+        }
+    }
+    printf("%s: %s\n", name, (errors) ? "FAILED" : "ok");
+    return errors;
+}
+
+// ns per frame of 'fun' over BENCH_BLOCKS blocks
+template <typename F>
+static double bench_time(F fun)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (int b = 0; b < BENCH_BLOCKS; b++) {
+        fun();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / (double(BENCH_BLOCKS) * BENCH_BUFFER_SIZE);
+}
+
+int main()
+{
+    printf("SIMD: %s\n", (SAMPLECONVERT_SSE2) ? "SSE2" : ((SAMPLECONVERT_XTENSA) ? "Xtensa FPU" : "none"));
+    int errors = 0;
+    errors += check_format<int32_t, 32>("s32", sampleconvert_s32_to_planar, sampleconvert_planar_to_s32);
+    errors += check_format<int32_t, 24>("s24", sampleconvert_s24_to_planar, sampleconvert_planar_to_s24);
+    errors += check_format<int16_t, 16>("s16", sampleconvert_s16_to_planar, sampleconvert_planar_to_s16);
+
+    // Benchmark, 32 stereo frames per block
+    std::vector<int32_t> frames(2 * BENCH_BUFFER_SIZE);
+    std::vector<int16_t> frames16(2 * BENCH_BUFFER_SIZE);
+    std::vector<float> left(BENCH_BUFFER_SIZE), right(BENCH_BUFFER_SIZE);
+    for (int i = 0; i < 2 * BENCH_BUFFER_SIZE; i++) {
+        frames[i] = int32_t(bench_random()) >> 1;
+        frames16[i] = int16_t(bench_random() >> 17);
+    }
+    float* volatile pleft = left.data();
+    float* volatile pright = right.data();
+    int32_t* volatile pframes = frames.data();
+
+    // The loops of esp32audio::audioTask before sampleconvert.h
+    double old_in = bench_time([&]() {
+        float* l = pleft;
+        float* r = pright;
+        const int32_t* f = pframes;
+        for (int i = 0; i < BENCH_BUFFER_SIZE; i++) {
+            l[i] = (float)f[i*2]*4.6566129e-10;
+            r[i] = (float)f[i*2+1]*4.6566129e-10;
+        }
+    });
+    double old_out = bench_time([&]() {
+        const float* l = pleft;
+        const float* r = pright;
+        int32_t* f = pframes;
+        for (int i = 0; i < BENCH_BUFFER_SIZE; i++) {
+            f[i*2] = std::max(-2147483647, std::min(2147483647, ((int32_t)(l[i] * 2147483647))));
+            f[i*2+1] = std::max(-2147483647, std::min(2147483647, ((int32_t)(r[i] * 2147483647))));
+        }
+    });
+    double s32_in = bench_time([&]() { sampleconvert_s32_to_planar(pframes, pleft, pright, BENCH_BUFFER_SIZE); });
+    double s32_out = bench_time([&]() { sampleconvert_planar_to_s32(pleft, pright, pframes, BENCH_BUFFER_SIZE); });
+    double s24_in = bench_time([&]() { sampleconvert_s24_to_planar(pframes, pleft, pright, BENCH_BUFFER_SIZE); });
+    double s24_out = bench_time([&]() { sampleconvert_planar_to_s24(pleft, pright, pframes, BENCH_BUFFER_SIZE); });
+    double s16_in = bench_time([&]() { sampleconvert_s16_to_planar(frames16.data(), pleft, pright, BENCH_BUFFER_SIZE); });
+    double s16_out = bench_time([&]() { sampleconvert_planar_to_s16(pleft, pright, frames16.data(), BENCH_BUFFER_SIZE); });
+
+    printf("ns per stereo frame   to float  from float\n");
+    printf("previous loops        %8.3f  %10.3f\n", old_in, old_out);
+    printf("s32                   %8.3f  %10.3f\n", s32_in, s32_out);
+    printf("s24                   %8.3f  %10.3f\n", s24_in, s24_out);
+    printf("s16                   %8.3f  %10.3f\n", s16_in, s16_out);
+    return (errors) ? 1 : 0;
+}
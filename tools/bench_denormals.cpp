@@ -0,0 +1,105 @@
+/************************************************************************
+ Wingie denormal benchmark
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/*
+ Measures the block time of mydsp::compute on the host, on a loud input
+ followed by a long silent tail, where the filter and resonator states decay
+ toward the subnormal range. With the denormal protection on, the silent
+ seconds should not cost more than the loud ones.
+
+ Build (from this directory):
+
+    c++ -O2 -std=c++11 -I../Wingie -o bench_denormals bench_denormals.cpp
+
+ Usage:
+
+    ./bench_denormals [--no-ftz]
+
+ --no-ftz leaves the FTZ/DAZ flags unset, build with -DDENORMAL_SNAP=0 to
+ also remove the in-graph snapping and see the unprotected behaviour.
+*/
+
+#include "Wingie.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define BENCH_SAMPLE_RATE 44100
+#define BENCH_BUFFER_SIZE 32
+#define BENCH_LOUD_SECONDS 2
+#define BENCH_SECONDS 60
+
+int main(int argc, char* argv[])
+{
+    bool ftz = !(argc > 1 && strcmp(argv[1], "--no-ftz") == 0);
+    if (ftz) {
+        AVOIDDENORMALS;
+    }
+
+    mydsp dsp;
+    dsp.init(BENCH_SAMPLE_RATE);
+    MapUI ui;
+    dsp.buildUserInterface(&ui);
+    ui.setParamValue("/Wingie/input_gain", 1.f);
+    ui.setParamValue("/Wingie/left/decay", 10.f);
+    ui.setParamValue("/Wingie/right/decay", 10.f);
+
+    std::vector<float> in0(BENCH_BUFFER_SIZE), in1(BENCH_BUFFER_SIZE);
+    std::vector<float> out0(BENCH_BUFFER_SIZE), out1(BENCH_BUFFER_SIZE);
+    float* inputs[2] = { in0.data(), in1.data() };
+    float* outputs[2] = { out0.data(), out1.data() };
+
+    printf("FTZ/DAZ %s, DENORMAL_SNAP %d, %d frames at %d Hz\n", (ftz) ? "on" : "off", DENORMAL_SNAP, BENCH_BUFFER_SIZE, BENCH_SAMPLE_RATE);
+    printf("second  input   mean (us)  max (us)\n");
+
+    const int blocks_per_second = BENCH_SAMPLE_RATE / BENCH_BUFFER_SIZE;
+    uint32_t seed = 1;
+    double loud_mean = 0., tail_mean = 0., tail_worst = 0.;
+
+    for (int second = 0; second < BENCH_SECONDS; second++) {
+        bool loud = second < BENCH_LOUD_SECONDS;
+        double sum = 0., max = 0.;
+        for (int block = 0; block < blocks_per_second; block++) {
+            for (int i = 0; i < BENCH_BUFFER_SIZE; i++) {
+                seed = seed * 1664525u + 1013904223u;
+                float noise = float(int32_t(seed)) * 4.6566129e-10f;
+                in0[i] = (loud) ? 0.5f * noise : 0.f;
+                in1[i] = (loud) ? 0.5f * noise : 0.f;
+            }
+            auto begin = std::chrono::steady_clock::now();
+            dsp.compute(BENCH_BUFFER_SIZE, inputs, outputs);
+            auto end = std::chrono::steady_clock::now();
+            double us = std::chrono::duration<double, std::micro>(end - begin).count();
+            sum += us;
+            max = std::max(max, us);
+        }
+        double mean = sum / blocks_per_second;
+        printf("%6d  %-6s  %9.3f  %8.3f\n", second, (loud) ? "loud" : "silent", mean, max);
+        if (loud) {
+            loud_mean += mean / BENCH_LOUD_SECONDS;
+        } else {
+            tail_mean += mean / (BENCH_SECONDS - BENCH_LOUD_SECONDS);
+            tail_worst = std::max(tail_worst, mean);
+        }
+    }
+
+    printf("silent / loud block time: %.2f on average, %.2f for the worst second\n", tail_mean / loud_mean, tail_worst / loud_mean);
+    return 0;
+}
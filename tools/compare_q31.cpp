@@ -0,0 +1,139 @@
+/************************************************************************
+ Wingie fixed-point engine check and benchmark
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/*
+ Runs mydsp::compute and mydsp::computeQ31 side by side on the same int32
+ input, as the ESP32 audio task would get it from I2S: noise bursts and
+ impulses, with note, route, decay and mute changes along the way. Prints the
+ difference between the two engines for each second, in dB relative to full
+ scale, and the mean block time of each engine, the float one including the
+ int32 <-> float conversions that the fixed-point engine skips.
+
+ Build (from this directory):
+
+    c++ -O2 -std=c++11 -I../Wingie -o compare_q31 compare_q31.cpp
+
+ FIXED_POINT is set to 1 here. On a host with a fast FPU, the float engine is
+ expected to be faster; the point of the timing is the ratio on targets that
+ emulate float in software.
+*/
+
+#define FIXED_POINT 1
+
+#include "Wingie.cpp"
+#include "sampleconvert.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define COMPARE_SAMPLE_RATE 44100
+#define COMPARE_BUFFER_SIZE 32
+#define COMPARE_SECONDS 12
+
+static double compare_db(double x)
+{
+    return (x > 0.) ? 20. * std::log10(x) : -999.;
+}
+
+static void compare_set(MapUI& ui0, MapUI& ui1, const char* path, float value)
+{
+    ui0.setParamValue(path, value);
+    ui1.setParamValue(path, value);
+}
+
+int main()
+{
+    AVOIDDENORMALS;
+
+    mydsp engine_float, engine_q31;
+    engine_float.init(COMPARE_SAMPLE_RATE);
+    engine_q31.init(COMPARE_SAMPLE_RATE);
+    MapUI ui_float, ui_q31;
+    engine_float.buildUserInterface(&ui_float);
+    engine_q31.buildUserInterface(&ui_q31);
+    compare_set(ui_float, ui_q31, "/Wingie/input_gain", 1.f);
+    compare_set(ui_float, ui_q31, "/Wingie/resonator_input_gain", 0.3f);
+
+    std::vector<float> in0(COMPARE_BUFFER_SIZE), in1(COMPARE_BUFFER_SIZE);
+    std::vector<float> out0(COMPARE_BUFFER_SIZE), out1(COMPARE_BUFFER_SIZE);
+    float* inputs[2] = { in0.data(), in1.data() };
+    float* outputs[2] = { out0.data(), out1.data() };
+    std::vector<int32_t> frames_in(2 * COMPARE_BUFFER_SIZE), frames_out(2 * COMPARE_BUFFER_SIZE), frames_float(2 * COMPARE_BUFFER_SIZE);
+
+    printf("FIXED_POINT vs float, %d frames at %d Hz\n", COMPARE_BUFFER_SIZE, COMPARE_SAMPLE_RATE);
+    printf("second  rms diff (dBFS)  max diff (dBFS)  float (us)  q31 (us)\n");
+
+    const int blocks_per_second = COMPARE_SAMPLE_RATE / COMPARE_BUFFER_SIZE;
+    uint32_t seed = 1;
+    double worst_rms = 0., worst_max = 0., float_sum = 0., q31_sum = 0.;
+    long frame = 0;
+
+    for (int second = 0; second < COMPARE_SECONDS; second++) {
+        // One scenario step per second
+        switch (second) {
+            case 2: compare_set(ui_float, ui_q31, "/Wingie/left/note0", 48.f); break;
+            case 3: compare_set(ui_float, ui_q31, "/Wingie/right/route1", 2.f); break;
+            case 4: compare_set(ui_float, ui_q31, "/Wingie/left/mute_1", 1.f); break;
+            case 5: compare_set(ui_float, ui_q31, "/Wingie/left/mute_1", 0.f); break;
+            case 6: compare_set(ui_float, ui_q31, "/Wingie/left/decay", 10.f); break;
+            case 7: compare_set(ui_float, ui_q31, "/Wingie/mode_changed", 1.f); break;
+            case 8: compare_set(ui_float, ui_q31, "/Wingie/mode_changed", 0.f); break;
+            case 9: compare_set(ui_float, ui_q31, "/Wingie/mix", 0.5f); break;
+            default: break;
+        }
+        double sum2 = 0., max = 0., float_us = 0., q31_us = 0.;
+        for (int block = 0; block < blocks_per_second; block++) {
+            for (int i = 0; i < COMPARE_BUFFER_SIZE; i++, frame++) {
+                seed = seed * 1664525u + 1013904223u;
+                // Noise bursts of 0.1 s every 0.5 s, impulses in between
+                bool burst = (frame % (COMPARE_SAMPLE_RATE / 2)) < (COMPARE_SAMPLE_RATE / 10);
+                bool impulse = (frame % (COMPARE_SAMPLE_RATE / 4)) == (COMPARE_SAMPLE_RATE / 8);
+                int32_t sample = (burst) ? (int32_t(seed) >> 2) : ((impulse) ? 0x40000000 : 0);
+                frames_in[2 * i] = sample;
+                frames_in[2 * i + 1] = sample >> 1;
+            }
+
+            auto begin = std::chrono::steady_clock::now();
+            sampleconvert_s32_to_planar(frames_in.data(), in0.data(), in1.data(), COMPARE_BUFFER_SIZE);
+            engine_float.compute(COMPARE_BUFFER_SIZE, inputs, outputs);
+            sampleconvert_planar_to_s32(out0.data(), out1.data(), frames_float.data(), COMPARE_BUFFER_SIZE);
+            auto middle = std::chrono::steady_clock::now();
+            engine_q31.computeQ31(COMPARE_BUFFER_SIZE, frames_in.data(), frames_out.data());
+            auto end = std::chrono::steady_clock::now();
+
+            float_us += std::chrono::duration<double, std::micro>(middle - begin).count();
+            q31_us += std::chrono::duration<double, std::micro>(end - middle).count();
+            for (int i = 0; i < 2 * COMPARE_BUFFER_SIZE; i++) {
+                double diff = (double(frames_out[i]) - double(frames_float[i])) / 2147483648.;
+                sum2 += diff * diff;
+                max = std::max(max, std::fabs(diff));
+            }
+        }
+        double rms = std::sqrt(sum2 / (2. * COMPARE_BUFFER_SIZE * blocks_per_second));
+        printf("%6d  %15.1f  %15.1f  %10.3f  %8.3f\n", second, compare_db(rms), compare_db(max), float_us / blocks_per_second, q31_us / blocks_per_second);
+        worst_rms = std::max(worst_rms, rms);
+        worst_max = std::max(worst_max, max);
+        float_sum += float_us;
+        q31_sum += q31_us;
+    }
+
+    printf("worst second: %.1f dBFS rms, %.1f dBFS peak; q31 / float block time: %.2f\n", compare_db(worst_rms), compare_db(worst_max), q31_sum / float_sum);
+    return 0;
+}
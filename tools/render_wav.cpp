@@ -0,0 +1,368 @@
+/************************************************************************
+ Wingie offline renderer
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/*
+ Streams a WAV file through mydsp::compute as fast as possible and writes
+ the result to another WAV file, to audition and regression-test resonator
+ settings on recordings without the board:
+
+    render_wav [options] input.wav output.wav
+
+    -b frames       block size (4096)
+    -s script       parameter changes, see below
+    -w bits         output format: 16, 24 or 32-bit integer PCM (32-bit float otherwise)
+    -t frames       frames of silence rendered after the input, for the tails (0)
+
+ The input is 16, 24 or 32-bit integer or 32-bit float PCM, mono (fed to
+ both resonators) or stereo, at any sample rate. The output is stereo at the
+ same rate. The script has one change per line, at a timestamp in frames
+ from the start of the input, '#' starting a comment:
+
+    # frame  parameter            value
+    0        /Wingie/left/note0   48
+    0        /Wingie/mix          0.5
+    88200    /Wingie/right/route1 2
+    132300   /Wingie/left/mute_3  1
+
+ Parameters are the full paths of mydsp::buildUserInterface, or their
+ labels when they are not ambiguous (mix, note0, note1, ...). Blocks are cut
+ at the timestamps, so that each change applies from its frame on.
+
+ Prints the rendered length and the throughput, of the DSP alone and of the
+ whole render including the file conversions.
+
+ Build (from this directory):
+
+    c++ -O2 -std=c++11 -I../Wingie -o render_wav render_wav.cpp
+
+ WAV files are read and written on little-endian hosts only.
+*/
+
+#include "Wingie.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define RENDER_FORMAT_PCM 1
+#define RENDER_FORMAT_FLOAT 3
+#define RENDER_FORMAT_EXTENSIBLE 0xFFFE
+
+struct render_event {
+    int64_t fFrame;
+    FAUSTFLOAT* fZone;
+    float fValue;
+};
+
+struct render_wav {
+    FILE* fFile;
+    int fFormat;
+    int fChannels;
+    int fSampleRate;
+    int fBits;
+    int64_t fFrames;        // in the data chunk
+    long fDataPos;          // file position of the data chunk
+};
+
+static uint32_t render_u32(const unsigned char* p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+static uint16_t render_u16(const unsigned char* p) { return uint16_t(p[0] | (p[1] << 8)); }
+
+// Walks the RIFF chunks up to "data", after "fmt "
+static bool render_open_input(const char* path, render_wav& wav)
+{
+    wav.fFile = fopen(path, "rb");
+    if (!wav.fFile) return false;
+    unsigned char riff[12];
+    if (fread(riff, 1, 12, wav.fFile) != 12 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) return false;
+    bool fmt = false;
+    unsigned char header[8];
+    while (fread(header, 1, 8, wav.fFile) == 8) {
+        uint32_t size = render_u32(header + 4);
+        if (memcmp(header, "fmt ", 4) == 0 && size >= 16) {
+            std::vector<unsigned char> chunk(size);
+            if (fread(chunk.data(), 1, size, wav.fFile) != size) return false;
+            wav.fFormat = render_u16(&chunk[0]);
+            wav.fChannels = render_u16(&chunk[2]);
+            wav.fSampleRate = int(render_u32(&chunk[4]));
+            wav.fBits = render_u16(&chunk[14]);
+            if (wav.fFormat == RENDER_FORMAT_EXTENSIBLE && size >= 26) {
+                // The format is the first field of the sub-format GUID
+                wav.fFormat = render_u16(&chunk[24]);
+            }
+            fmt = true;
+            // Chunks are padded to an even size
+            if (size & 1) fseek(wav.fFile, 1, SEEK_CUR);
+        } else if (memcmp(header, "data", 4) == 0) {
+            // The format has to come first
+            if (!fmt) return false;
+            bool supported = (wav.fFormat == RENDER_FORMAT_PCM && (wav.fBits == 16 || wav.fBits == 24 || wav.fBits == 32))
+                || (wav.fFormat == RENDER_FORMAT_FLOAT && wav.fBits == 32);
+            if (!supported || wav.fChannels < 1) return false;
+            wav.fFrames = size / (wav.fChannels * (wav.fBits / 8));
+            wav.fDataPos = ftell(wav.fFile);
+            return true;
+        } else {
+            fseek(wav.fFile, long(size + (size & 1)), SEEK_CUR);
+        }
+    }
+    return false;
+}
+
+// Reads up to 'count' frames to planar float, returns the frames read
+static int render_read(render_wav& wav, std::vector<unsigned char>& raw, float* left, float* right, int count)
+{
+    int bytes = wav.fBits / 8;
+    int frame_bytes = wav.fChannels * bytes;
+    raw.resize(size_t(frame_bytes) * count);
+    int frames = int(fread(raw.data(), frame_bytes, count, wav.fFile));
+    for (int i = 0; i < frames; i++) {
+        const unsigned char* frame = &raw[size_t(i) * frame_bytes];
+        float sample[2];
+        for (int c = 0; c < 2; c++) {
+            const unsigned char* p = frame + std::min<int>(c, wav.fChannels - 1) * bytes;
+            if (wav.fFormat == RENDER_FORMAT_FLOAT) {
+                memcpy(&sample[c], p, sizeof(float));
+            } else if (bytes == 2) {
+                sample[c] = sampleconvert_to_float<16>(int16_t(render_u16(p)));
+            } else if (bytes == 3) {
+                // Sign extension of the 24-bit sample
+                sample[c] = sampleconvert_to_float<24>(int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24) >> 8);
+            } else {
+                sample[c] = sampleconvert_to_float<32>(int32_t(render_u32(p)));
+            }
+        }
+        left[i] = sample[0];
+        right[i] = sample[1];
+    }
+    return frames;
+}
+
+static void render_put(std::vector<unsigned char>& out, uint32_t value, int bytes)
+{
+    for (int b = 0; b < bytes; b++) {
+        out.push_back((unsigned char)(value >> (8 * b)));
+    }
+}
+
+// The header of a stereo file, sizes filled in by render_close_output
+static bool render_open_output(const char* path, render_wav& wav, int sample_rate, int bits)
+{
+    wav.fFile = fopen(path, "wb");
+    if (!wav.fFile) return false;
+    wav.fFormat = (bits) ? RENDER_FORMAT_PCM : RENDER_FORMAT_FLOAT;
+    wav.fChannels = 2;
+    wav.fSampleRate = sample_rate;
+    wav.fBits = (bits) ? bits : 32;
+    wav.fFrames = 0;
+    std::vector<unsigned char> header;
+    header.insert(header.end(), { 'R', 'I', 'F', 'F' });
+    render_put(header, 0, 4);
+    header.insert(header.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+    render_put(header, 16, 4);
+    render_put(header, wav.fFormat, 2);
+    render_put(header, wav.fChannels, 2);
+    render_put(header, sample_rate, 4);
+    render_put(header, sample_rate * wav.fChannels * (wav.fBits / 8), 4);
+    render_put(header, wav.fChannels * (wav.fBits / 8), 2);
+    render_put(header, wav.fBits, 2);
+    header.insert(header.end(), { 'd', 'a', 't', 'a' });
+    render_put(header, 0, 4);
+    wav.fDataPos = long(header.size());
+    return fwrite(header.data(), 1, header.size(), wav.fFile) == header.size();
+}
+
+static bool render_write(render_wav& wav, std::vector<unsigned char>& raw, const float* left, const float* right, int count)
+{
+    int bytes = wav.fBits / 8;
+    raw.resize(size_t(2 * bytes) * count);
+    unsigned char* p = raw.data();
+    for (int i = 0; i < count; i++) {
+        for (int c = 0; c < 2; c++, p += bytes) {
+            float x = (c) ? right[i] : left[i];
+            if (wav.fFormat == RENDER_FORMAT_FLOAT) {
+                memcpy(p, &x, sizeof(float));
+            } else {
+                uint32_t v = (bytes == 2) ? uint32_t(sampleconvert_from_float<16>(x))
+                    : ((bytes == 3) ? uint32_t(sampleconvert_from_float<24>(x)) : uint32_t(sampleconvert_from_float<32>(x)));
+                for (int b = 0; b < bytes; b++) {
+                    p[b] = (unsigned char)(v >> (8 * b));
+                }
+            }
+        }
+    }
+    wav.fFrames += count;
+    return fwrite(raw.data(), 1, raw.size(), wav.fFile) == raw.size();
+}
+
+static bool render_close_output(render_wav& wav)
+{
+    std::vector<unsigned char> size;
+    uint32_t data = uint32_t(wav.fFrames * wav.fChannels * (wav.fBits / 8));
+    render_put(size, uint32_t(wav.fDataPos) - 8 + data, 4);
+    render_put(size, data, 4);
+    bool ok = fseek(wav.fFile, 4, SEEK_SET) == 0 && fwrite(&size[0], 1, 4, wav.fFile) == 4
+        && fseek(wav.fFile, wav.fDataPos - 4, SEEK_SET) == 0 && fwrite(&size[4], 1, 4, wav.fFile) == 4;
+    return (fclose(wav.fFile) == 0) && ok;
+}
+
+// One change per line: frame, parameter, value
+static bool render_load_script(const char* path, MapUI& ui, std::vector<render_event>& events)
+{
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        render_event event;
+        std::string param;
+        if (!(fields >> event.fFrame)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            fprintf(stderr, "%s:%d: expected a frame\n", path, number);
+            return false;
+        }
+        if (!(fields >> param >> event.fValue) || event.fFrame < 0) {
+            fprintf(stderr, "%s:%d: expected 'frame parameter value'\n", path, number);
+            return false;
+        }
+        event.fZone = ui.getParamZone(param);
+        if (!event.fZone) {
+            fprintf(stderr, "%s:%d: unknown parameter %s\n", path, number, param.c_str());
+            return false;
+        }
+        events.push_back(event);
+    }
+    // In time order, those of the same frame in the script order
+    std::stable_sort(events.begin(), events.end(), [](const render_event& a, const render_event& b) { return a.fFrame < b.fFrame; });
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: render_wav [-b frames] [-s script] [-w 16|24|32] [-t frames] input.wav output.wav\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    int bsize = 4096;
+    int bits = 0;
+    int64_t tail = 0;
+    const char* script = nullptr;
+    std::vector<const char*> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool value = (i + 1 < argc);
+        if (arg == "-b" && value) {
+            bsize = atoi(argv[++i]);
+        } else if (arg == "-s" && value) {
+            script = argv[++i];
+        } else if (arg == "-w" && value) {
+            bits = atoi(argv[++i]);
+            if (bits != 16 && bits != 24 && bits != 32) usage();
+        } else if (arg == "-t" && value) {
+            tail = atoll(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage();
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() != 2 || bsize <= 0 || tail < 0) usage();
+
+    AVOIDDENORMALS;
+
+    render_wav input = {}, output = {};
+    if (!render_open_input(paths[0], input)) {
+        fprintf(stderr, "%s: not a 16, 24, 32-bit PCM or 32-bit float WAV file\n", paths[0]);
+        return 1;
+    }
+    fseek(input.fFile, input.fDataPos, SEEK_SET);
+
+    mydsp* dsp = new mydsp();
+    dsp->init(input.fSampleRate);
+    MapUI ui;
+    dsp->buildUserInterface(&ui);
+    std::vector<render_event> events;
+    if (script && !render_load_script(script, ui, events)) return 1;
+
+    if (!render_open_output(paths[1], output, input.fSampleRate, bits)) {
+        fprintf(stderr, "cannot write %s\n", paths[1]);
+        return 1;
+    }
+
+    std::vector<float> in0(bsize), in1(bsize), out0(bsize), out1(bsize);
+    float* inputs[2] = { in0.data(), in1.data() };
+    float* outputs[2] = { out0.data(), out1.data() };
+    std::vector<unsigned char> raw;
+    const int64_t length = input.fFrames + tail;
+    size_t next = 0;
+    double dsp_seconds = 0.;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int64_t frame = 0; frame < length; ) {
+        // Changes due at this frame, then a block up to the next one
+        for (; next < events.size() && events[next].fFrame <= frame; next++) {
+            *events[next].fZone = events[next].fValue;
+        }
+        int64_t end = std::min<int64_t>(length, frame + bsize);
+        if (next < events.size()) end = std::min<int64_t>(end, events[next].fFrame);
+        int count = int(end - frame);
+
+        int got = (frame < input.fFrames) ? render_read(input, raw, in0.data(), in1.data(), int(std::min<int64_t>(count, input.fFrames - frame))) : 0;
+        std::fill(in0.begin() + got, in0.begin() + count, 0.f);
+        std::fill(in1.begin() + got, in1.begin() + count, 0.f);
+
+        auto compute = std::chrono::steady_clock::now();
+        dsp->compute(count, inputs, outputs);
+        dsp_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - compute).count();
+
+        if (!render_write(output, raw, out0.data(), out1.data(), count)) {
+            fprintf(stderr, "cannot write %s\n", paths[1]);
+            return 1;
+        }
+        frame = end;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    fclose(input.fFile);
+    if (!render_close_output(output)) {
+        fprintf(stderr, "cannot write %s\n", paths[1]);
+        return 1;
+    }
+    delete dsp;
+
+    double audio_seconds = double(length) / input.fSampleRate;
+    printf("%lld frames (%.2f s at %d Hz), %d parameter changes, blocks of %d frames\n",
+           (long long)length, audio_seconds, input.fSampleRate, int(events.size()), bsize);
+    printf("dsp:    %.3f s, %.0f samples/s per channel, %.1f x real time\n",
+           dsp_seconds, double(length) / dsp_seconds, audio_seconds / dsp_seconds);
+    printf("render: %.3f s, %.0f samples/s per channel, %.1f x real time\n",
+           seconds, double(length) / seconds, audio_seconds / seconds);
+    return 0;
+}
@@ -0,0 +1,150 @@
+/************************************************************************
+ Wingie on the host, through the Linux audio driver
+ Copyright (C) 2021 Meng Qi
+ ---------------------------------------------------------------------
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; If not, see <http://www.gnu.org/licenses/>.
+ ************************************************************************/
+
+/*
+ Runs the Wingie DSP with linuxaudio (see Wingie.cpp), with the mode
+ governor as on the board, on raw interleaved stereo int32 PCM:
+
+    wingie_host [options] input output
+
+ 'input' and 'output' are files, pipes or FIFOs, "-" for stdin and stdout,
+ "" for silence in or for no output. Options:
+
+    -r rate         sample rate (44100)
+    -b frames       block size (32)
+    -f              file mode, as fast as possible (real time otherwise)
+    -n frames       frames to compute (default: up to the end of the input)
+    -p path=value   parameter, e.g. -p /Wingie/left/note0=48 (repeatable)
+
+ The timing statistics of the audio thread go to stderr, every second in
+ real time and at the end. For instance, with ALSA:
+
+    arecord -t raw -f S32_LE -c 2 -r 44100 | ./wingie_host - - | aplay -t raw -f S32_LE -c 2 -r 44100
+
+ Build (from this directory):
+
+    c++ -O2 -std=c++11 -I../Wingie -o wingie_host wingie_host.cpp -lpthread
+
+ SCHED_FIFO needs the rights for it (root, or an rtprio limit in
+ /etc/security/limits.conf), the audio thread runs with the default
+ scheduling otherwise.
+*/
+
+#include "Wingie.cpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void print_stats(linuxaudio& audio, modegovernor& governor)
+{
+    audiostats stats;
+    if (!audio.getStats(stats, true)) return;
+    fprintf(stderr, "%.1f s, load %.1f %%, xruns %d (%d over, %d under), modes %d\n",
+            double(audio.getFrames()) / audio.getSampleRate(), 100. * stats.getLoad(),
+            audio.getXRuns(), audio.getOverruns(), audio.getUnderruns(), governor.getNumModes(0));
+    fprintf(stderr, "  phase (us)       min     mean      99%%      max\n");
+    for (int p = 0; p < audiostats::kPhases; p++) {
+        fprintf(stderr, "  %-10s  %8.1f %8.1f %8.1f %8.1f\n", audiostats::getName(p),
+                stats.getMin(p), stats.getMean(p), stats.getPercentile(p, 99.f), stats.getMax(p));
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: wingie_host [-r rate] [-b frames] [-f] [-n frames] [-p path=value]... input output\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    int rate = 44100;
+    int bsize = 32;
+    int mode = kHostRealTime;
+    int64_t frames = -1;
+    std::vector<std::pair<std::string, float> > params;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool value = (i + 1 < argc);
+        if (arg == "-r" && value) {
+            rate = atoi(argv[++i]);
+        } else if (arg == "-b" && value) {
+            bsize = atoi(argv[++i]);
+        } else if (arg == "-f") {
+            mode = kHostFile;
+        } else if (arg == "-n" && value) {
+            frames = atoll(argv[++i]);
+        } else if (arg == "-p" && value) {
+            std::string param = argv[++i];
+            size_t eq = param.find('=');
+            if (eq == std::string::npos) usage();
+            params.push_back(std::make_pair(param.substr(0, eq), float(atof(param.c_str() + eq + 1))));
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage();
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != 2 || rate <= 0 || bsize <= 0 || (paths[0].empty() && frames < 0 && mode == kHostFile)) usage();
+
+    // A closed output pipe is reported by write
+    signal(SIGPIPE, SIG_IGN);
+
+    mydsp* dsp = new mydsp();
+    linuxaudio audio(rate, bsize, paths[0], paths[1], mode, frames);
+    if (!audio.init("wingie_host", dsp)) {
+        fprintf(stderr, "cannot open %s or %s: %s\n", paths[0].c_str(), paths[1].c_str(), strerror(errno));
+        return 1;
+    }
+
+    MapUI ui;
+    dsp->buildUserInterface(&ui);
+    for (auto& it : params) {
+        ui.setParamValue(it.first, it.second);
+    }
+
+    modegovernor governor(&audio, dsp);
+    if (mode == kHostRealTime) {
+        audio.addControlCallback(modegovernor::control, &governor);
+    }
+
+    if (!audio.start()) {
+        fprintf(stderr, "cannot start the audio thread\n");
+        return 1;
+    }
+    if (mode == kHostRealTime && !audio.isRealTime()) {
+        fprintf(stderr, "no SCHED_FIFO, the audio thread runs with the default scheduling\n");
+    }
+
+    while (mode == kHostRealTime) {
+        sleep(1);
+        if (!audio.isRunning()) break;
+        print_stats(audio, governor);
+    }
+    // The whole run in file mode, the last second in real time
+    audio.wait();
+    print_stats(audio, governor);
+
+    delete dsp;
+    return 0;
+}